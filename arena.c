@@ -0,0 +1,134 @@
+/* Copyright (C) 2021 by Alexandru-Sergiu Marton
+
+   This file is part of shell243.
+   
+   shell243 is free software: you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+   
+   shell243 is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+   
+   You should have received a copy of the GNU General Public License
+   along with shell243.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "arena.h"
+
+#define ARENA_CHUNK_SIZE (64 * 1024)
+
+static size_t
+align_up (size_t size)
+{
+  const size_t align = sizeof (max_align_t);
+  return (size + align - 1) & ~(align - 1);
+}
+
+static arena_chunk *
+new_chunk (const arena *a, size_t size, arena_chunk *next)
+{
+  size_t min_size = a->chunk_size ? a->chunk_size : ARENA_CHUNK_SIZE;
+  if (size < min_size)
+    size = min_size;
+
+  arena_chunk *chunk = (arena_chunk *) malloc (sizeof (arena_chunk) + size);
+  if (!chunk)
+    {
+      perror ("arena");
+      exit (EXIT_FAILURE);
+    }
+  chunk->next = next;
+  chunk->size = size;
+  chunk->used = 0;
+
+  return chunk;
+}
+
+void *
+arena_alloc (arena *a, size_t size)
+{
+  size = align_up (size);
+
+  if (!a->current)
+    a->head = a->current = new_chunk (a, size, NULL);
+  else if (a->current->size - a->current->used < size)
+    {
+      // Chunks after the current one are left over from before the
+      // last reset; reuse the next one if it's big enough.
+      arena_chunk *next = a->current->next;
+      if (!next || next->size < size)
+	next = new_chunk (a, size, next);
+      next->used = 0;
+      a->current->next = next;
+      a->current = next;
+    }
+
+  void *ptr = (char *) a->current->data + a->current->used;
+  a->current->used += size;
+  return ptr;
+}
+
+void *
+arena_realloc (arena *a, void *ptr, size_t old_size, size_t new_size)
+{
+  arena_chunk *c = a->current;
+  size_t old_aligned = align_up (old_size), new_aligned = align_up (new_size);
+
+  if (ptr && c && (char *) ptr + old_aligned == (char *) c->data + c->used
+      && c->used - old_aligned + new_aligned <= c->size)
+    {
+      c->used = c->used - old_aligned + new_aligned;
+      return ptr;
+    }
+
+  void *moved = arena_alloc (a, new_size);
+  if (ptr)
+    memcpy (moved, ptr, old_size < new_size ? old_size : new_size);
+  return moved;
+}
+
+char *
+arena_strndup (arena *a, const char *s, size_t n)
+{
+  char *copy = (char *) arena_alloc (a, n + 1);
+  memcpy (copy, s, n);
+  copy[n] = '\0';
+  return copy;
+}
+
+void
+arena_reset (arena *a)
+{
+  a->current = a->head;
+  if (a->current)
+    a->current->used = 0;
+}
+
+void
+arena_release (arena *a)
+{
+  arena_chunk *chunk = a->head;
+  while (chunk)
+    {
+      arena_chunk *next = chunk->next;
+      free (chunk);
+      chunk = next;
+    }
+  a->head = a->current = NULL;
+}
+
+size_t
+arena_footprint (const arena *a)
+{
+  size_t total = 0;
+  for (const arena_chunk *chunk = a->head; chunk; chunk = chunk->next)
+    total += sizeof (arena_chunk) + chunk->size;
+  return total;
+}
@@ -0,0 +1,62 @@
+/* Copyright (C) 2021 by Alexandru-Sergiu Marton
+
+   This file is part of shell243.
+   
+   shell243 is free software: you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+   
+   shell243 is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+   
+   You should have received a copy of the GNU General Public License
+   along with shell243.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef SH243_ARENA_H
+#define SH243_ARENA_H
+
+#include <stddef.h>
+
+// A region allocator: allocations are bump-pointer cheap and can't be
+// freed one by one, only all at once with arena_reset. Chunks are kept
+// across resets, so a warmed-up arena doesn't call malloc at all.
+
+typedef struct arena_chunk
+{
+  struct arena_chunk *next;
+  size_t size, used;
+  max_align_t data[];
+} arena_chunk;
+
+typedef struct arena
+{
+  arena_chunk *head, *current;
+  size_t chunk_size; // 0 for the default of 64 KiB
+} arena;
+
+void *
+arena_alloc (arena *a, size_t size);
+
+// Grows `ptr', the block of `old_size' bytes allocated last, in place
+// when the chunk has room; otherwise moves it to a new block.
+void *
+arena_realloc (arena *a, void *ptr, size_t old_size, size_t new_size);
+
+char *
+arena_strndup (arena *a, const char *s, size_t n);
+
+void
+arena_reset (arena *a);
+
+void
+arena_release (arena *a);
+
+// Bytes of memory held by the arena's chunks.
+size_t
+arena_footprint (const arena *a);
+
+#endif
@@ -0,0 +1,163 @@
+/* Copyright (C) 2021 by Alexandru-Sergiu Marton
+
+   This file is part of shell243.
+   
+   shell243 is free software: you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+   
+   shell243 is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+   
+   You should have received a copy of the GNU General Public License
+   along with shell243.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "astcache.h"
+#include "arena.h"
+#include "options.h"
+#include "stats.h"
+
+typedef struct cache_entry
+{
+  uint32_t hash;
+  size_t len;
+  char *line;
+  const ast_node *ast;
+  size_t bytes;
+  arena storage;
+  struct cache_entry *next; // in the bucket
+  struct cache_entry *newer, *older;
+} cache_entry;
+
+#define NBUCKETS 1024
+#define NSEEN 4096
+
+static cache_entry *buckets[NBUCKETS];
+// The hashes of lines that missed, by hash. Two lines that share a
+// slot only cost a copy of a line that turns out not to repeat.
+static uint32_t seen[NSEEN];
+static cache_entry *newest, *oldest;
+static size_t cache_bytes = 0;
+
+static uint32_t
+hash_line (const char *s, size_t len)
+{
+  uint32_t h = 2166136261u;
+  for (size_t i = 0; i < len; i++)
+    h = (h ^ (unsigned char) s[i]) * 16777619u;
+  return h;
+}
+
+static size_t
+budget ()
+{
+  return (size_t) options.astcache * 1024;
+}
+
+static void
+unlink_lru (cache_entry *e)
+{
+  if (e->newer)
+    e->newer->older = e->older;
+  else
+    newest = e->older;
+  if (e->older)
+    e->older->newer = e->newer;
+  else
+    oldest = e->newer;
+}
+
+static void
+push_newest (cache_entry *e)
+{
+  e->newer = NULL;
+  e->older = newest;
+  if (newest)
+    newest->newer = e;
+  else
+    oldest = e;
+  newest = e;
+}
+
+static void
+evict (cache_entry *e)
+{
+  cache_entry **p = &buckets[e->hash % NBUCKETS];
+  while (*p != e)
+    p = &(*p)->next;
+  *p = e->next;
+
+  unlink_lru (e);
+  cache_bytes -= e->bytes;
+  arena_release (&e->storage);
+  free (e);
+  stat_count (STAT_CACHE_EVICT);
+}
+
+// Evicts entries until `extra' more bytes fit in the budget.
+static void
+make_room (size_t extra)
+{
+  while (oldest && cache_bytes + extra > budget ())
+    evict (oldest);
+}
+
+const ast_node *
+astcache_lookup (const char *line, size_t len, bool *worth)
+{
+  *worth = false;
+  make_room (0); // the budget may have shrunk
+  if (budget () == 0)
+    return NULL;
+
+  uint32_t hash = hash_line (line, len);
+  for (cache_entry *e = buckets[hash % NBUCKETS]; e; e = e->next)
+    if (e->hash == hash && e->len == len && memcmp (e->line, line, len) == 0)
+      {
+	unlink_lru (e);
+	push_newest (e);
+	stat_count (STAT_CACHE_HIT);
+	return e->ast;
+      }
+
+  stat_count (STAT_CACHE_MISS);
+  *worth = seen[hash % NSEEN] == hash;
+  seen[hash % NSEEN] = hash;
+  return NULL;
+}
+
+void
+astcache_insert (const char *line, size_t len, const ast_node *ast)
+{
+  if (budget () == 0)
+    return;
+
+  cache_entry *e = (cache_entry *) calloc (1, sizeof (cache_entry));
+  e->storage.chunk_size = 1024;
+  e->hash = hash_line (line, len);
+  e->len = len;
+  e->line = arena_strndup (&e->storage, line, len);
+  e->ast = ast_clone (&e->storage, ast);
+  e->bytes = sizeof (cache_entry) + arena_footprint (&e->storage);
+
+  if (e->bytes > budget ())
+    {
+      arena_release (&e->storage);
+      free (e);
+      return;
+    }
+
+  make_room (e->bytes);
+  e->next = buckets[e->hash % NBUCKETS];
+  buckets[e->hash % NBUCKETS] = e;
+  push_newest (e);
+  cache_bytes += e->bytes;
+}
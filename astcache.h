@@ -0,0 +1,44 @@
+/* Copyright (C) 2021 by Alexandru-Sergiu Marton
+
+   This file is part of shell243.
+   
+   shell243 is free software: you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+   
+   shell243 is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+   
+   You should have received a copy of the GNU General Public License
+   along with shell243.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef SH243_ASTCACHE_H
+#define SH243_ASTCACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "parser.h"
+
+// A cache of parsed lines, for input that repeats the same commands
+// over and over. Lines are looked up by their text as read, before the
+// lexer rewrites them; the trees are private copies that nothing
+// modifies, evicted least recently used first once they take more than
+// set -o astcache KiB. A line is only worth caching the second time it
+// is seen, so input whose lines never repeat isn't copied at all.
+
+// Returns the tree cached for `line', or NULL. On a miss, *worth tells
+// whether `line' was seen before and should be inserted once parsed.
+const ast_node *
+astcache_lookup (const char *line, size_t len, bool *worth);
+
+// Caches a copy of `ast', the tree parsed from `line'. `line' must be
+// the text before it went through the lexer.
+void
+astcache_insert (const char *line, size_t len, const ast_node *ast);
+
+#endif
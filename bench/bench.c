@@ -0,0 +1,399 @@
+/* Copyright (C) 2021 by Alexandru-Sergiu Marton
+
+   This file is part of shell243.
+   
+   shell243 is free software: you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+   
+   shell243 is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+   
+   You should have received a copy of the GNU General Public License
+   along with shell243.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+// Benchmarks for the front end (lexer and parser) and for launching
+// commands. Every benchmark is run a number of times and the min,
+// median and 99th percentile of the runs are reported, which is what
+// should be compared between commits. The scaling checks at the end
+// make it exit with 1 when the lexer stops being linear. Build and
+// run it with "make bench".
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#include "lexer.h"
+#include "parser.h"
+#include "eval.h"
+#include "reaper.h"
+
+typedef struct benchmark
+{
+  const char *name;
+  void (*setup) (struct benchmark *b);
+  void (*run) (struct benchmark *b);
+  char *input;     // the text given to the lexer or the shell
+  size_t size;     // strlen (input)
+  size_t bytes;    // bytes processed per run, for MB/s; 0 for none
+  int runs;        // overrides the -n option when not 0
+  char *buf;       // scratch copy of input; lexing rewrites it
+  ast_node *ast;   // parsed once, for the launch benchmarks
+} benchmark;
+
+static char *
+repeat (const char *piece, int n, const char *last)
+{
+  size_t len = strlen (piece);
+  char *s = (char *) malloc (len * n + strlen (last) + 1);
+  for (int i = 0; i < n; i++)
+    memcpy (s + len * i, piece, len);
+  strcpy (s + len * n, last);
+  return s;
+}
+
+static uint64_t
+now_ns ()
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+// Front end
+
+static void
+setup_input (benchmark *b)
+{
+  b->size = strlen (b->input);
+  b->bytes = b->size;
+  b->buf = (char *) malloc (b->size + 1);
+}
+
+static void
+setup_long_words (benchmark *b)
+{
+  char *word = repeat ("x", 4000, " ");
+  b->input = repeat (word, 1000, "");
+  free (word);
+  setup_input (b);
+}
+
+#define QUOTED_PIECE "'a b c'\"d \\\"e\\\" f\"g\\ h "
+
+static void
+setup_quoted (benchmark *b)
+{
+  b->input = repeat (QUOTED_PIECE, 100000, "");
+  setup_input (b);
+}
+
+static void
+setup_pipeline (benchmark *b)
+{
+  b->input = repeat ("cmd arg | ", 9999, "cmd arg");
+  setup_input (b);
+}
+
+static void
+setup_and_chain (benchmark *b)
+{
+  b->input = repeat ("true && ", 9999, "true");
+  setup_input (b);
+}
+
+static void
+setup_pipeline_100k (benchmark *b)
+{
+  b->input = repeat ("cmd arg | ", 99999, "cmd arg");
+  setup_input (b);
+}
+
+static void
+setup_and_chain_100k (benchmark *b)
+{
+  b->input = repeat ("true && false || ", 50000, "true");
+  setup_input (b);
+}
+
+static void
+run_lexer (benchmark *b)
+{
+  init_lexer (b->buf);
+  while (next_token ().type != TOK_EOF)
+    ;
+}
+
+static void
+run_parser (benchmark *b)
+{
+  init_lexer (b->buf);
+  parse ();
+  parser_reset ();
+}
+
+// Launcher
+
+static void
+setup_command (benchmark *b)
+{
+  b->size = strlen (b->input);
+  b->buf = strdup (b->input);
+  init_lexer (b->buf);
+  b->ast = parse ();
+  if (check_ast_error (b->ast))
+    exit (EXIT_FAILURE);
+}
+
+#define THROUGHPUT_BYTES (64 << 20)
+
+static void
+setup_throughput (benchmark *b)
+{
+  static char command[128];
+  sprintf (command, "head -c %d /dev/zero | cat | cat > /dev/null",
+	   THROUGHPUT_BYTES);
+  b->input = command;
+  setup_command (b);
+  b->bytes = THROUGHPUT_BYTES;
+}
+
+static void
+setup_eval_chain (benchmark *b)
+{
+  b->input = repeat (": && ", 99999, ":");
+  setup_command (b);
+}
+
+static void
+run_command (benchmark *b)
+{
+  eval (b->ast);
+}
+
+#define BENCH(bname, bsetup, brun) .name = bname, .setup = bsetup, .run = brun
+
+static benchmark benchmarks[] = {
+  { BENCH ("lex/long-words", setup_long_words, run_lexer) },
+  { BENCH ("lex/quoting", setup_quoted, run_lexer) },
+  { BENCH ("parse/pipeline-10k", setup_pipeline, run_parser) },
+  { BENCH ("parse/and-chain-10k", setup_and_chain, run_parser) },
+  { BENCH ("parse/pipeline-100k", setup_pipeline_100k, run_parser),
+    .runs = 20 },
+  { BENCH ("parse/and-or-100k", setup_and_chain_100k, run_parser),
+    .runs = 20 },
+  { BENCH ("launch/builtin", setup_command, run_command), .input = "true" },
+  { BENCH ("launch/external", setup_command, run_command),
+    .input = "/bin/true" },
+  { BENCH ("launch/pipeline-3", setup_command, run_command),
+    .input = "/bin/true | /bin/true | /bin/true" },
+  { BENCH ("eval/and-chain-100k", setup_eval_chain, run_command),
+    .runs = 20 },
+  { BENCH ("pipe/throughput", setup_throughput, run_command), .runs = 10 },
+};
+
+#define NBENCHMARKS (sizeof (benchmarks) / sizeof (benchmarks[0]))
+
+static int
+compare_ns (const void *a, const void *b)
+{
+  uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+  return (x > y) - (x < y);
+}
+
+static void
+print_ns (uint64_t ns)
+{
+  if (ns < 10000)
+    printf (" %9lu ns", (unsigned long) ns);
+  else if (ns < 10000000)
+    printf (" %9.1f us", ns / 1e3);
+  else
+    printf (" %9.1f ms", ns / 1e6);
+}
+
+static void
+run_benchmark (benchmark *b, int runs)
+{
+  if (b->runs)
+    runs = b->runs;
+  uint64_t *samples = (uint64_t *) malloc (sizeof (uint64_t) * runs);
+
+  b->setup (b);
+  for (int i = -1; i < runs; i++) // the first run warms up
+    {
+      if (b->run != run_command)
+	memcpy (b->buf, b->input, b->size + 1);
+
+      uint64_t start = now_ns ();
+      b->run (b);
+      if (i >= 0)
+	samples[i] = now_ns () - start;
+    }
+
+  qsort (samples, runs, sizeof (uint64_t), compare_ns);
+  uint64_t median = samples[runs / 2];
+
+  printf ("%-22s %6d", b->name, runs);
+  print_ns (samples[0]);
+  print_ns (median);
+  print_ns (samples[(runs * 99) / 100 < runs ? (runs * 99) / 100 : runs - 1]);
+  if (b->bytes)
+    printf (" %10.1f", b->bytes / (median / 1e9) / (1 << 20));
+  putchar ('\n');
+  fflush (stdout);
+
+  free (samples);
+}
+
+// Scaling checks: the lexer must stay linear in the length of its
+// input, so lexing 4 times as much input may take at most
+// SCALE_LIMIT times as long. A quadratic lexer takes about 16 times
+// as long. The best of a few runs is compared, to leave out noise. A
+// run on the larger input that goes over the limit on its own is
+// stopped by a timer, since a quadratic lexer would take minutes
+// there.
+
+#define SCALE_SMALL (1 << 20)
+#define SCALE_LIMIT 8.0
+#define SCALE_RUNS 10
+#define SCALE_BUDGET 1000000000u // ns; fewer runs once it is spent
+
+typedef struct scaling
+{
+  const char *name;
+  const char *piece; // repeated to make the input
+} scaling;
+
+static const scaling scalings[] = {
+  { "scale/lex-quoting", QUOTED_PIECE },
+  { "scale/lex-long-words", "x" } // one long word
+};
+
+#define NSCALINGS (sizeof (scalings) / sizeof (scalings[0]))
+
+static void
+scale_timeout (int sig)
+{
+  (void) sig;
+  const char msg[] = "  timed out     FAILED\n";
+  write (STDOUT_FILENO, msg, sizeof (msg) - 1);
+  _exit (1);
+}
+
+// The best time of lexing `bytes' bytes of `piece', repeated. Each run
+// is stopped, failing the benchmark, after `timeout' ns if it isn't 0.
+static uint64_t
+time_lexing (const char *piece, size_t bytes, uint64_t timeout)
+{
+  benchmark b = { .input = repeat (piece, bytes / strlen (piece), "") };
+  setup_input (&b);
+
+  struct itimerval timer = {
+    .it_value = { .tv_sec = timeout / 1000000000u,
+		  .tv_usec = timeout % 1000000000u / 1000 }
+  }, off = { 0 };
+  signal (SIGALRM, scale_timeout);
+
+  uint64_t best = UINT64_MAX, total = 0;
+  for (int i = 0; i < SCALE_RUNS && total < SCALE_BUDGET; i++)
+    {
+      memcpy (b.buf, b.input, b.size + 1);
+      if (timeout)
+	setitimer (ITIMER_REAL, &timer, NULL);
+      uint64_t start = now_ns ();
+      run_lexer (&b);
+      uint64_t ns = now_ns () - start;
+      setitimer (ITIMER_REAL, &off, NULL);
+      if (ns < best)
+	best = ns;
+      total += ns;
+    }
+
+  free (b.input);
+  free (b.buf);
+  return best;
+}
+
+// Prints how the time grows from SCALE_SMALL to 4 times as much input,
+// and returns whether that is within SCALE_LIMIT.
+static bool
+check_scaling (const scaling *s)
+{
+  printf ("%-22s %6s", s->name, "");
+  fflush (stdout);
+  uint64_t small = time_lexing (s->piece, SCALE_SMALL, 0);
+  print_ns (small);
+  fflush (stdout);
+  uint64_t large = time_lexing (s->piece, SCALE_SMALL * 4,
+				small * SCALE_LIMIT + 1000000);
+  double ratio = small ? (double) large / small : 0;
+  bool ok = ratio <= SCALE_LIMIT;
+
+  print_ns (large);
+  printf (" %11.1fx %10s\n", ratio, ok ? "ok" : "FAILED");
+  fflush (stdout);
+
+  return ok;
+}
+
+static bool
+selected (const char *name, int argc, char **argv)
+{
+  if (optind == argc)
+    return true;
+  for (int a = optind; a < argc; a++)
+    if (strncmp (name, argv[a], strlen (argv[a])) == 0)
+      return true;
+  return false;
+}
+
+int
+main (int argc, char **argv)
+{
+  int runs = 100, opt;
+
+  while ((opt = getopt (argc, argv, "n:")) != -1)
+    if (opt == 'n' && atoi (optarg) > 0)
+      runs = atoi (optarg);
+    else
+      {
+	fprintf (stderr, "usage: %s [-n runs] [name-prefix...]\n", argv[0]);
+	return 2;
+      }
+
+  reaper_init ();
+
+  printf ("%-22s %6s %12s %12s %12s %10s\n", "benchmark", "runs", "min",
+	  "median", "p99", "MB/s");
+  for (size_t i = 0; i < NBENCHMARKS; i++)
+    if (selected (benchmarks[i].name, argc, argv))
+      run_benchmark (&benchmarks[i], runs);
+
+  bool linear = true, header = false;
+  for (size_t i = 0; i < NSCALINGS; i++)
+    if (selected (scalings[i].name, argc, argv) && !header)
+      {
+	printf ("\n%-22s %6s %12s %12s %12s\n", "scaling", "", "1 MB", "4 MB",
+		"ratio");
+	header = true;
+      }
+  for (size_t i = 0; i < NSCALINGS; i++)
+    if (selected (scalings[i].name, argc, argv)
+	&& !check_scaling (&scalings[i]))
+      linear = false;
+
+  return linear ? 0 : 1;
+}
@@ -0,0 +1,713 @@
+/* Copyright (C) 2021 by Alexandru-Sergiu Marton
+   Copyright (C) 2021 by Daria Mihaela Broscoțeanu
+   Copyright (C) 2021 by Andreea Diana Gherghescu
+
+   This file is part of shell243.
+
+   shell243 is free software: you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   shell243 is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with shell243.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <limits.h>
+#include <sys/wait.h>
+#include <sys/stat.h>
+#include <pwd.h>
+
+#include "builtins.h"
+#include "job.h"
+#include "cmdhash.h"
+#include "reaper.h"
+#include "parallel.h"
+#include "stats.h"
+#include "options.h"
+#include "eval.h"
+#include "waiter.h"
+#include "copy.h"
+
+static int
+builtin_cd (int argc, char **argv)
+{
+  if (argc > 2)
+    {
+      errno = EINVAL;
+      perror ("cd");
+      return EXIT_FAILURE;
+    }
+  else if (argc == 1)
+    {
+      struct passwd *pw = getpwuid (getuid ());
+      const char *homedir = pw->pw_dir;
+      if (chdir (homedir) != 0)
+	{
+	  perror ("cd");
+	  return EXIT_FAILURE;
+	}
+    }
+  else
+    {
+      if (chdir (argv[1]) != 0)
+	{
+	  perror ("cd");
+	  return EXIT_FAILURE;
+	}
+    }
+
+  return EXIT_SUCCESS;
+}
+
+static int
+builtin_jobs (int argc, char **argv)
+{
+  (void) argv;
+  if (argc > 1)
+    {
+      errno = EINVAL;
+      perror ("jobs");
+      return EXIT_FAILURE;
+    }
+
+  reap_children ();
+
+  job *j = job_next (NULL);
+  while (j)
+    {
+      job *next = job_next (j);
+      printf ("[%d]+ ", j->jid);
+      if (j->state == JOB_QUEUED)
+	printf ("Queued\n");
+      else if (j->state == JOB_RUNNING)
+	printf ("Running\n");
+      else if (j->state == JOB_STOPPED)
+	printf ("Stopped by signal %d\n", WSTOPSIG (j->status));
+      else
+	{
+	  if (WIFSIGNALED (j->status))
+	    printf ("Killed by signal %d\n", WTERMSIG (j->status));
+	  else
+	    puts ("Done");
+	  job_remove (j);
+	}
+      j = next;
+    }
+
+  return EXIT_SUCCESS;
+}
+
+static int
+builtin_exit (int argc, char **argv)
+{
+  if (argc > 2)
+    {
+      errno = EINVAL;
+      perror ("exit");
+      return EXIT_FAILURE;
+    }
+
+  if (argc == 2)
+    {
+      errno = 0;
+      char *endptr;
+      long retval = strtol (argv[1], &endptr, 10);
+
+      if (errno != 0)
+	{
+	  perror ("exit: strtol");
+	  return EXIT_FAILURE;
+	}
+
+      if (endptr == argv[1])
+	{
+	  errno = EINVAL;
+	  perror ("exit: strtol");
+	  return EXIT_FAILURE;
+	}
+
+      exit (retval);
+    }
+  else
+    exit (EXIT_SUCCESS);
+}
+
+static int
+builtin_hash (int argc, char **argv)
+{
+  if (argc == 1)
+    {
+      cmdhash_print ();
+      return EXIT_SUCCESS;
+    }
+
+  if (strcmp (argv[1], "-r") == 0 && argc == 2)
+    {
+      cmdhash_clear ();
+      return EXIT_SUCCESS;
+    }
+  else if (strcmp (argv[1], "-p") == 0)
+    {
+      if (argc != 4)
+	{
+	  errno = EINVAL;
+	  perror ("hash");
+	  return EXIT_FAILURE;
+	}
+      cmdhash_add (argv[3], argv[2]);
+      return EXIT_SUCCESS;
+    }
+
+  int retval = EXIT_SUCCESS;
+  for (int i = 1; i < argc; i++)
+    if (!cmdhash_lookup (argv[i]))
+      {
+	fprintf (stderr, "hash: %s: not found\n", argv[i]);
+	retval = EXIT_FAILURE;
+      }
+
+  return retval;
+}
+
+static int
+builtin_true (int argc, char **argv)
+{
+  (void) argc, (void) argv;
+  return EXIT_SUCCESS;
+}
+
+static int
+builtin_false (int argc, char **argv)
+{
+  (void) argc, (void) argv;
+  return EXIT_FAILURE;
+}
+
+static int
+builtin_echo (int argc, char **argv)
+{
+  bool newline = true;
+  int i = 1;
+  for (; i < argc && strcmp (argv[i], "-n") == 0; i++)
+    newline = false;
+
+  for (int first = i; i < argc; i++)
+    {
+      if (i > first)
+	putchar (' ');
+      fputs (argv[i], stdout);
+    }
+  if (newline)
+    putchar ('\n');
+
+  return ferror (stdout) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+static int
+builtin_pwd (int argc, char **argv)
+{
+  (void) argc, (void) argv;
+  char cwd[PATH_MAX];
+  if (!getcwd (cwd, sizeof (cwd)))
+    {
+      perror ("pwd");
+      return EXIT_FAILURE;
+    }
+  puts (cwd);
+
+  return EXIT_SUCCESS;
+}
+
+// Prints the exit status of each stage of the last pipe sequence.
+static int
+builtin_pipestatus (int argc, char **argv)
+{
+  (void) argc, (void) argv;
+  int len;
+  const int *statuses = last_pipestatus (&len);
+  for (int i = 0; i < len; i++)
+    printf (i ? " %d" : "%d", statuses[i]);
+  putchar ('\n');
+
+  return EXIT_SUCCESS;
+}
+
+// printf
+
+// Prints the escape sequence at `s' and returns how many characters it
+// took up.
+static int
+print_escape (const char *s)
+{
+  static const char escapes[] = "a\ab\bf\fn\nr\rt\tv\v\\\\";
+  const char *e = strchr (escapes, s[1]);
+
+  if (s[1] != '\0' && e && (e - escapes) % 2 == 0)
+    {
+      putchar (e[1]);
+      return 2;
+    }
+  if (s[1] >= '0' && s[1] <= '7')
+    {
+      int value = 0, len = 1;
+      while (len < 4 && s[len] >= '0' && s[len] <= '7')
+	value = value * 8 + s[len++] - '0';
+      putchar (value);
+      return len;
+    }
+  putchar ('\\');
+  return 1;
+}
+
+static long long
+printf_number (const char *arg, bool *ok)
+{
+  if (arg[0] == '\'' || arg[0] == '"')
+    return (unsigned char) arg[1];
+
+  char *endptr;
+  errno = 0;
+  long long value = strtoll (arg, &endptr, 0);
+  if (errno != 0 || endptr == arg || *endptr != '\0')
+    {
+      fprintf (stderr, "printf: %s: invalid number\n", arg);
+      *ok = false;
+    }
+  return value;
+}
+
+// Prints `format' once, taking arguments from `args'. Returns how many
+// it used, or -1 on a bad format.
+static int
+printf_once (const char *format, char **args, int nargs, bool *ok)
+{
+  int used = 0;
+  const char *p = format;
+
+  while (*p)
+    {
+      if (*p == '\\')
+	{
+	  p += print_escape (p);
+	  continue;
+	}
+      if (*p != '%')
+	{
+	  putchar (*p++);
+	  continue;
+	}
+      if (p[1] == '%')
+	{
+	  putchar ('%');
+	  p += 2;
+	  continue;
+	}
+
+      // Copy the flags, width and precision, then add our own length
+      // modifier.
+      char spec[32] = "%";
+      size_t len = 1;
+      const char *start = ++p;
+      p += strspn (p, "-+ #0");
+      p += strspn (p, "0123456789");
+      if (*p == '.')
+	p += 1 + strspn (p + 1, "0123456789");
+      if ((size_t) (p - start) + 4 > sizeof (spec))
+	{
+	  fprintf (stderr, "printf: %s: invalid format\n", format);
+	  return -1;
+	}
+      memcpy (spec + len, start, p - start);
+      len += p - start;
+
+      const char *arg = used < nargs ? args[used] : NULL;
+      if (arg)
+	used++;
+
+      switch (*p)
+	{
+	case 'd':
+	case 'i':
+	  strcpy (spec + len, "lld");
+	  printf (spec, arg ? printf_number (arg, ok) : 0LL);
+	  break;
+	case 'u':
+	case 'o':
+	case 'x':
+	case 'X':
+	  sprintf (spec + len, "ll%c", *p);
+	  printf (spec, arg ? (unsigned long long) printf_number (arg, ok)
+		  : 0ULL);
+	  break;
+	case 'c':
+	  strcpy (spec + len, "c");
+	  printf (spec, arg ? arg[0] : '\0');
+	  break;
+	case 's':
+	  strcpy (spec + len, "s");
+	  printf (spec, arg ? arg : "");
+	  break;
+	default:
+	  fprintf (stderr, "printf: %%%c: invalid directive\n", *p);
+	  return -1;
+	}
+      p++;
+    }
+
+  return used;
+}
+
+static int
+builtin_printf (int argc, char **argv)
+{
+  if (argc < 2)
+    {
+      fputs ("printf: usage: printf format [arguments]\n", stderr);
+      return 2;
+    }
+
+  bool ok = true;
+  char **args = argv + 2;
+  int nargs = argc - 2;
+
+  // The format is reused as long as it consumes arguments.
+  do
+    {
+      int used = printf_once (argv[1], args, nargs, &ok);
+      if (used < 0)
+	return EXIT_FAILURE;
+      if (used == 0)
+	break;
+      args += used;
+      nargs -= used;
+    }
+  while (nargs > 0);
+
+  return ok && !ferror (stdout) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// test and [
+//
+// expr    = or ;
+// or      = and, { "-o", and } ;
+// and     = not, { "-a", not } ;
+// not     = "!", not | primary ;
+// primary = "(", expr, ")" | UNARY, arg | arg, BINARY, arg | arg ;
+
+static char **test_args;
+static int test_pos, test_end;
+static bool test_error;
+
+static bool
+test_or ();
+
+static const char *
+test_next ()
+{
+  if (test_pos >= test_end)
+    {
+      fputs ("test: argument expected\n", stderr);
+      test_error = true;
+      return "";
+    }
+  return test_args[test_pos++];
+}
+
+static bool
+is_binary_op (const char *s)
+{
+  static const char *ops[] = { "=", "==", "!=", "-eq", "-ne", "-lt",
+			       "-le", "-gt", "-ge" };
+  for (size_t i = 0; i < sizeof (ops) / sizeof (ops[0]); i++)
+    if (strcmp (s, ops[i]) == 0)
+      return true;
+  return false;
+}
+
+static bool
+is_unary_op (const char *s)
+{
+  return s[0] == '-' && s[1] && strchr ("bcdefghLnprsSwxz", s[1])
+    && s[2] == '\0';
+}
+
+static long long
+test_integer (const char *s)
+{
+  char *endptr;
+  errno = 0;
+  long long value = strtoll (s, &endptr, 10);
+  if (errno != 0 || endptr == s || *endptr != '\0')
+    {
+      fprintf (stderr, "test: %s: integer expression expected\n", s);
+      test_error = true;
+    }
+  return value;
+}
+
+static bool
+test_binary (const char *left, const char *op, const char *right)
+{
+  if (strcmp (op, "=") == 0 || strcmp (op, "==") == 0)
+    return strcmp (left, right) == 0;
+  if (strcmp (op, "!=") == 0)
+    return strcmp (left, right) != 0;
+
+  long long a = test_integer (left), b = test_integer (right);
+  if (strcmp (op, "-eq") == 0)
+    return a == b;
+  if (strcmp (op, "-ne") == 0)
+    return a != b;
+  if (strcmp (op, "-lt") == 0)
+    return a < b;
+  if (strcmp (op, "-le") == 0)
+    return a <= b;
+  if (strcmp (op, "-gt") == 0)
+    return a > b;
+  return a >= b;
+}
+
+static bool
+test_unary (char op, const char *arg)
+{
+  struct stat st;
+
+  switch (op)
+    {
+    case 'n':
+      return *arg != '\0';
+    case 'z':
+      return *arg == '\0';
+    case 'r':
+      return access (arg, R_OK) == 0;
+    case 'w':
+      return access (arg, W_OK) == 0;
+    case 'x':
+      return access (arg, X_OK) == 0;
+    case 'h':
+    case 'L':
+      return lstat (arg, &st) == 0 && S_ISLNK (st.st_mode);
+    }
+
+  if (stat (arg, &st) != 0)
+    return false;
+  switch (op)
+    {
+    case 'b':
+      return S_ISBLK (st.st_mode);
+    case 'c':
+      return S_ISCHR (st.st_mode);
+    case 'd':
+      return S_ISDIR (st.st_mode);
+    case 'f':
+      return S_ISREG (st.st_mode);
+    case 'g':
+      return st.st_mode & S_ISGID;
+    case 'p':
+      return S_ISFIFO (st.st_mode);
+    case 's':
+      return st.st_size > 0;
+    case 'S':
+      return S_ISSOCK (st.st_mode);
+    default: // 'e'
+      return true;
+    }
+}
+
+static bool
+test_primary ()
+{
+  const char *arg = test_next ();
+
+  if (strcmp (arg, "(") == 0)
+    {
+      bool result = test_or ();
+      if (strcmp (test_next (), ")") != 0)
+	{
+	  fputs ("test: `)' expected\n", stderr);
+	  test_error = true;
+	}
+      return result;
+    }
+
+  if (test_pos + 1 < test_end && is_binary_op (test_args[test_pos]))
+    {
+      const char *op = test_next ();
+      return test_binary (arg, op, test_next ());
+    }
+
+  if (is_unary_op (arg) && test_pos < test_end)
+    return test_unary (arg[1], test_next ());
+
+  return *arg != '\0';
+}
+
+static bool
+test_not ()
+{
+  if (test_pos < test_end && strcmp (test_args[test_pos], "!") == 0
+      && test_pos + 1 < test_end)
+    {
+      test_pos++;
+      return !test_not ();
+    }
+  return test_primary ();
+}
+
+static bool
+test_and ()
+{
+  bool result = test_not ();
+  while (test_pos < test_end && strcmp (test_args[test_pos], "-a") == 0)
+    {
+      test_pos++;
+      result = test_not () && result;
+    }
+  return result;
+}
+
+static bool
+test_or ()
+{
+  bool result = test_and ();
+  while (test_pos < test_end && strcmp (test_args[test_pos], "-o") == 0)
+    {
+      test_pos++;
+      result = test_and () || result;
+    }
+  return result;
+}
+
+static int
+builtin_test (int argc, char **argv)
+{
+  if (strcmp (argv[0], "[") == 0)
+    {
+      if (strcmp (argv[argc - 1], "]") != 0)
+	{
+	  fputs ("[: missing `]'\n", stderr);
+	  return 2;
+	}
+      argc--;
+    }
+
+  if (argc == 1)
+    return EXIT_FAILURE;
+
+  test_args = argv;
+  test_pos = 1;
+  test_end = argc;
+  test_error = false;
+
+  bool result = test_or ();
+  if (test_pos < test_end && !test_error)
+    {
+      fprintf (stderr, "test: %s: unexpected argument\n", argv[test_pos]);
+      test_error = true;
+    }
+
+  if (test_error)
+    return 2;
+  return result ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// Lookup
+
+typedef struct builtin
+{
+  const char *name;
+  builtin_func func;
+} builtin;
+
+static const builtin builtins[] = {
+  { "cd", builtin_cd },
+  { "jobs", builtin_jobs },
+  { "exit", builtin_exit },
+  { "hash", builtin_hash },
+  { ":", builtin_true },
+  { "true", builtin_true },
+  { "false", builtin_false },
+  { "echo", builtin_echo },
+  { "printf", builtin_printf },
+  { "pwd", builtin_pwd },
+  { "pipestatus", builtin_pipestatus },
+  { "test", builtin_test },
+  { "[", builtin_test },
+  { "parallel", builtin_parallel },
+  { "parstatus", builtin_parstatus },
+  { "set", builtin_set },
+  { "shstat", builtin_shstat },
+  { "wait", builtin_wait },
+  { "timeout", builtin_timeout },
+  { "cat", builtin_cat },
+  { "tee", builtin_tee },
+};
+
+#define NBUILTINS (sizeof (builtins) / sizeof (builtins[0]))
+#define TABLE_SIZE 64
+
+// builtin_table is a perfect hash table: the seed is picked the first
+// time it's needed so that no two builtins share a slot, which makes a
+// lookup one hash and at most one strcmp.
+static const builtin *builtin_table[TABLE_SIZE];
+static uint32_t builtin_seed = 0;
+
+static uint32_t
+hash_name (const char *s, uint32_t seed)
+{
+  uint32_t h = 2166136261u ^ seed;
+  while (*s)
+    h = (h ^ (unsigned char) *s++) * 16777619u;
+  // The low bits of an FNV hash only depend on the low bits of the
+  // seed, so fold the high bits in or there are only TABLE_SIZE seeds.
+  return (h ^ (h >> 16)) & (TABLE_SIZE - 1);
+}
+
+static void
+build_table ()
+{
+  for (uint32_t seed = 1;; seed++)
+    {
+      memset (builtin_table, 0, sizeof (builtin_table));
+      size_t i;
+      for (i = 0; i < NBUILTINS; i++)
+	{
+	  uint32_t slot = hash_name (builtins[i].name, seed);
+	  if (builtin_table[slot])
+	    break;
+	  builtin_table[slot] = &builtins[i];
+	}
+      if (i == NBUILTINS)
+	{
+	  builtin_seed = seed;
+	  return;
+	}
+    }
+}
+
+builtin_func
+builtin_lookup (const char *name)
+{
+  if (!builtin_seed)
+    build_table ();
+
+  const builtin *b = builtin_table[hash_name (name, builtin_seed)];
+  if (b && strcmp (b->name, name) == 0)
+    return b->func;
+  return NULL;
+}
@@ -0,0 +1,32 @@
+/* Copyright (C) 2021 by Alexandru-Sergiu Marton
+   Copyright (C) 2021 by Daria Mihaela Broscoțeanu
+   Copyright (C) 2021 by Andreea Diana Gherghescu
+
+   This file is part of shell243.
+
+   shell243 is free software: you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   shell243 is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with shell243.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef SH243_BUILTINS_H
+#define SH243_BUILTINS_H
+
+// Builtins get the command's argv and return its exit status.
+typedef int (*builtin_func) (int argc, char **argv);
+
+// Returns the builtin called `name', or NULL if there is none.
+builtin_func
+builtin_lookup (const char *name);
+
+#endif
@@ -0,0 +1,147 @@
+/* Copyright (C) 2021 by Alexandru-Sergiu Marton
+
+   This file is part of shell243.
+   
+   shell243 is free software: you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+   
+   shell243 is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+   
+   You should have received a copy of the GNU General Public License
+   along with shell243.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "bytecode.h"
+#include "debug.h"
+
+static int
+emit (bytecode *bc, opcode op, int a, int b)
+{
+  if (bc->len == bc->cap)
+    {
+      bc->cap = bc->cap ? bc->cap * 2 : 16;
+      bc->code = (instruction *) realloc (bc->code,
+					  sizeof (instruction) * bc->cap);
+    }
+
+  bc->code[bc->len] = (instruction) { op, a, b };
+  return bc->len++;
+}
+
+static int
+add_constant (bytecode *bc, constant c)
+{
+  if (bc->npool == bc->pool_cap)
+    {
+      bc->pool_cap = bc->pool_cap ? bc->pool_cap * 2 : 16;
+      bc->pool = (constant *) realloc (bc->pool,
+				       sizeof (constant) * bc->pool_cap);
+    }
+
+  bc->pool[bc->npool] = c;
+  return bc->npool++;
+}
+
+static void
+compile_pipe_seq (bytecode *bc, const ast_node *ast)
+{
+  emit (bc, OP_PIPE, ast->len, 0);
+  for (int i = 0; i < ast->len; i++)
+    emit (bc, OP_SPAWN,
+	  add_constant (bc, (constant) { .plan = ast->children[i]->plan }), 0);
+  emit (bc, OP_WAIT, 0, 0);
+}
+
+// "a && b || c" is parsed as ((a && b) || c), so a chain is a left
+// spine of AST_AND and AST_OR nodes. It is compiled from the bottom of
+// the spine up: each operator tests the status left by everything
+// before it and jumps over its right operand.
+static void
+compile_and_or (bytecode *bc, const ast_node *ast)
+{
+  int depth = 0;
+  for (const ast_node *n = ast; n->type == AST_AND || n->type == AST_OR;
+       n = n->children[0])
+    depth++;
+
+  const ast_node **spine =
+    (const ast_node **) malloc (sizeof (ast_node *) * depth);
+  const ast_node *n = ast;
+  for (int i = 0; i < depth; i++, n = n->children[0])
+    spine[i] = n;
+
+  compile (bc, n);
+  for (int i = depth - 1; i >= 0; i--)
+    {
+      int jump = emit (bc, spine[i]->type == AST_AND ? OP_JUMP_IF_FAIL
+		       : OP_JUMP_IF_OK, 0, 0);
+      compile (bc, spine[i]->children[1]);
+      bc->code[jump].a = bc->len;
+    }
+
+  free (spine);
+}
+
+static void
+compile_program (bytecode *bc, const ast_node *ast)
+{
+  for (int i = 0; i < ast->len; i++)
+    {
+      const ast_node *child = ast->children[i];
+      if (child->type == AST_SEMI || child->type == AST_AMP)
+	continue;
+
+      if (i + 1 < ast->len && ast->children[i + 1]->type == AST_AMP)
+	{
+	  int job = emit (bc, OP_BACKGROUND,
+			  add_constant (bc, (constant) { .node = child }), 0);
+	  compile (bc, child);
+	  bc->code[job].b = bc->len;
+	}
+      else
+	compile (bc, child);
+    }
+}
+
+void
+compile (bytecode *bc, const ast_node *ast)
+{
+  switch (ast->type)
+    {
+    case AST_PROGRAM:
+      compile_program (bc, ast);
+      break;
+    case AST_AND:
+    case AST_OR:
+      compile_and_or (bc, ast);
+      break;
+    case AST_PIPE_SEQ:
+      compile_pipe_seq (bc, ast);
+      break;
+    case AST_TIME:
+      emit (bc, OP_TIME, 0, 0);
+      compile (bc, ast->children[0]);
+      emit (bc, OP_TIME_END, 0, 0);
+      break;
+    default:
+      fprintf (stderr, "Unexpected AST node: %s",
+	       ast_type_to_string (ast->type));
+      break;
+    }
+}
+
+void
+bytecode_free (bytecode *bc)
+{
+  free (bc->code);
+  free (bc->pool);
+  *bc = (bytecode) { 0 };
+}
@@ -0,0 +1,71 @@
+/* Copyright (C) 2021 by Alexandru-Sergiu Marton
+
+   This file is part of shell243.
+   
+   shell243 is free software: you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+   
+   shell243 is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+   
+   You should have received a copy of the GNU General Public License
+   along with shell243.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef SH243_BYTECODE_H
+#define SH243_BYTECODE_H
+
+#include "parser.h"
+#include "plan.h"
+
+// The tree of a line is compiled into a flat array of instructions
+// before it runs, so that evaluating it is a loop instead of a
+// recursion over the tree. Jumps are instruction indices.
+
+typedef enum opcode
+{
+  OP_PIPE,         // a: stages; starts a pipe sequence
+  OP_SPAWN,        // a: the stage's plan; starts the next stage
+  OP_WAIT,         // waits for the pipe sequence and sets the status
+  OP_JUMP_IF_FAIL, // a: target, taken when the status isn't 0
+  OP_JUMP_IF_OK,   // a: target, taken when the status is 0
+  OP_BACKGROUND,   // a: the job's tree, b: end of the job's code
+  OP_TIME,         // starts timing the code up to the OP_TIME_END
+  OP_TIME_END
+} opcode;
+
+typedef struct instruction
+{
+  opcode op;
+  int a, b;
+} instruction;
+
+// Operands that aren't numbers live in the constant pool, and are
+// referred to by their index.
+typedef union constant
+{
+  const command_plan *plan;
+  const ast_node *node;
+} constant;
+
+typedef struct bytecode
+{
+  instruction *code;
+  int len, cap;
+  constant *pool;
+  int npool, pool_cap;
+} bytecode;
+
+// Appends the code of `ast' to `bc'. The pool points into the tree,
+// which has to outlive the code.
+void
+compile (bytecode *bc, const ast_node *ast);
+
+void
+bytecode_free (bytecode *bc);
+
+#endif
@@ -0,0 +1,218 @@
+/* Copyright (C) 2021 by Alexandru-Sergiu Marton
+
+   This file is part of shell243.
+   
+   shell243 is free software: you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+   
+   shell243 is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+   
+   You should have received a copy of the GNU General Public License
+   along with shell243.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "cmdhash.h"
+
+typedef struct cmd_entry
+{
+  char *name;
+  char *path;
+  int hits;
+  struct cmd_entry *next;
+} cmd_entry;
+
+static cmd_entry **buckets = NULL;
+static size_t nbuckets = 0, nentries = 0;
+
+// Value of PATH the table was filled with.
+static char *hashed_path = NULL;
+
+static uint32_t
+hash_string (const char *s)
+{
+  uint32_t h = 2166136261u;
+  while (*s)
+    h = (h ^ (unsigned char) *s++) * 16777619u;
+  return h;
+}
+
+static void
+grow ()
+{
+  size_t new_nbuckets = nbuckets ? nbuckets * 2 : 64;
+  cmd_entry **new_buckets =
+    (cmd_entry **) calloc (new_nbuckets, sizeof (cmd_entry *));
+
+  for (size_t i = 0; i < nbuckets; i++)
+    {
+      cmd_entry *e = buckets[i];
+      while (e)
+	{
+	  cmd_entry *next = e->next;
+	  size_t b = hash_string (e->name) & (new_nbuckets - 1);
+	  e->next = new_buckets[b];
+	  new_buckets[b] = e;
+	  e = next;
+	}
+    }
+
+  free (buckets);
+  buckets = new_buckets;
+  nbuckets = new_nbuckets;
+}
+
+static cmd_entry *
+find (const char *name)
+{
+  if (!nbuckets)
+    return NULL;
+
+  cmd_entry *e = buckets[hash_string (name) & (nbuckets - 1)];
+  while (e && strcmp (e->name, name) != 0)
+    e = e->next;
+  return e;
+}
+
+static void
+check_path ()
+{
+  const char *path = getenv ("PATH");
+  if (!path)
+    path = "";
+  if (hashed_path && strcmp (hashed_path, path) == 0)
+    return;
+
+  cmdhash_clear ();
+  free (hashed_path);
+  hashed_path = strdup (path);
+}
+
+// Does the same search as execvp, but without trying to execute
+// anything.
+static char *
+search_path (const char *name)
+{
+  size_t name_len = strlen (name);
+  const char *dir = hashed_path;
+
+  for (;;)
+    {
+      const char *end = strchr (dir, ':');
+      size_t dir_len = end ? (size_t) (end - dir) : strlen (dir);
+      char *candidate = (char *) malloc (dir_len + name_len + 3);
+
+      if (dir_len == 0)
+	sprintf (candidate, "./%s", name);
+      else
+	sprintf (candidate, "%.*s/%s", (int) dir_len, dir, name);
+
+      struct stat st;
+      if (stat (candidate, &st) == 0 && S_ISREG (st.st_mode)
+	  && access (candidate, X_OK) == 0)
+	return candidate;
+      free (candidate);
+
+      if (!end)
+	return NULL;
+      dir = end + 1;
+    }
+}
+
+const char *
+cmdhash_lookup (const char *name)
+{
+  if (strchr (name, '/'))
+    return NULL;
+
+  check_path ();
+  cmd_entry *e = find (name);
+  if (!e)
+    {
+      char *path = search_path (name);
+      if (!path)
+	return NULL;
+      cmdhash_add (name, path);
+      free (path);
+      e = find (name);
+    }
+
+  e->hits++;
+  return e->path;
+}
+
+void
+cmdhash_add (const char *name, const char *path)
+{
+  check_path ();
+
+  cmd_entry *e = find (name);
+  if (e)
+    {
+      free (e->path);
+      e->path = strdup (path);
+      e->hits = 0;
+      return;
+    }
+
+  if (nentries >= nbuckets)
+    grow ();
+
+  size_t b = hash_string (name) & (nbuckets - 1);
+  e = (cmd_entry *) malloc (sizeof (cmd_entry));
+  e->name = strdup (name);
+  e->path = strdup (path);
+  e->hits = 0;
+  e->next = buckets[b];
+  buckets[b] = e;
+  nentries++;
+}
+
+void
+cmdhash_clear ()
+{
+  for (size_t i = 0; i < nbuckets; i++)
+    {
+      cmd_entry *e = buckets[i];
+      while (e)
+	{
+	  cmd_entry *next = e->next;
+	  free (e->name);
+	  free (e->path);
+	  free (e);
+	  e = next;
+	}
+      buckets[i] = NULL;
+    }
+  nentries = 0;
+}
+
+void
+cmdhash_print ()
+{
+  check_path ();
+  if (!nentries)
+    {
+      puts ("hash: hash table empty");
+      return;
+    }
+
+  puts ("hits\tcommand");
+  for (size_t i = 0; i < nbuckets; i++)
+    for (cmd_entry *e = buckets[i]; e; e = e->next)
+      printf ("%4d\t%s\n", e->hits, e->path);
+}
@@ -0,0 +1,37 @@
+/* Copyright (C) 2021 by Alexandru-Sergiu Marton
+
+   This file is part of shell243.
+   
+   shell243 is free software: you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+   
+   shell243 is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+   
+   You should have received a copy of the GNU General Public License
+   along with shell243.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef SH243_CMDHASH_H
+#define SH243_CMDHASH_H
+
+// Remembers where in $PATH commands were found, so each command is
+// searched for only once. The table is flushed whenever PATH changes.
+
+const char *
+cmdhash_lookup (const char *name);
+
+void
+cmdhash_add (const char *name, const char *path);
+
+void
+cmdhash_clear ();
+
+void
+cmdhash_print ();
+
+#endif
@@ -0,0 +1,426 @@
+/* Copyright (C) 2021 by Alexandru-Sergiu Marton
+
+   This file is part of shell243.
+   
+   shell243 is free software: you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+   
+   shell243 is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+   
+   You should have received a copy of the GNU General Public License
+   along with shell243.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#define _GNU_SOURCE // splice, tee, copy_file_range
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/sendfile.h>
+
+#include "copy.h"
+#include "spawner.h"
+#include "cmdhash.h"
+
+// How much one call moves at most.
+#define CHUNK (1 << 20)
+#define BUFFER_SIZE (128 * 1024)
+
+// What a process killed by SIGPIPE would have returned. The shell
+// ignores SIGPIPE, so these see EPIPE instead.
+#define BROKEN_PIPE (128 + SIGPIPE)
+
+static char buffer[BUFFER_SIZE];
+
+// Set by SIGINT while cat or tee runs. They run in the shell, which
+// ignores SIGINT at a prompt, so without this ^C couldn't stop them.
+static volatile sig_atomic_t interrupted;
+
+static void
+on_sigint (int sig)
+{
+  (void) sig;
+  interrupted = 1;
+}
+
+// Catches SIGINT, without SA_RESTART so that blocked calls return
+// EINTR, until stop_catching puts `old' back.
+static void
+catch_sigint (struct sigaction *old)
+{
+  struct sigaction sa;
+  sa.sa_handler = on_sigint;
+  sigemptyset (&sa.sa_mask);
+  sa.sa_flags = 0;
+  interrupted = 0;
+  sigaction (SIGINT, &sa, old);
+}
+
+static void
+stop_catching (const struct sigaction *old)
+{
+  sigaction (SIGINT, old, NULL);
+}
+
+// Whether a copy loop should give up because of ^C, with errno set
+// for the COPY_FAILED it then returns.
+static bool
+stop_copying ()
+{
+  if (interrupted)
+    errno = EINTR;
+  return interrupted;
+}
+
+typedef enum
+  {
+    COPY_DONE,
+    COPY_FAILED, // errno says why
+    COPY_UNSUPPORTED // the fds don't allow it, and nothing was moved
+  } copy_result;
+
+typedef ssize_t (*move_func) (int in, int out, size_t len);
+
+static ssize_t
+move_range (int in, int out, size_t len)
+{
+  return copy_file_range (in, NULL, out, NULL, len, 0);
+}
+
+static ssize_t
+move_splice (int in, int out, size_t len)
+{
+  return splice (in, NULL, out, NULL, len, SPLICE_F_MOVE);
+}
+
+static ssize_t
+move_sendfile (int in, int out, size_t len)
+{
+  return sendfile (out, in, NULL, len);
+}
+
+static copy_result
+copy_with (move_func move, int in, int out)
+{
+  bool moved = false;
+  while (!stop_copying ())
+    {
+      ssize_t n = move (in, out, CHUNK);
+      if (n > 0)
+	moved = true;
+      else if (n == 0)
+	return COPY_DONE;
+      else if (errno != EINTR)
+	return !moved && (errno == EINVAL || errno == ENOSYS || errno == EXDEV
+			  || errno == EBADF || errno == EOPNOTSUPP)
+	  ? COPY_UNSUPPORTED : COPY_FAILED;
+    }
+  return COPY_FAILED;
+}
+
+static bool
+write_all (int fd, const char *buf, size_t len)
+{
+  while (len > 0)
+    {
+      ssize_t n = write (fd, buf, len);
+      if (n == -1 && errno == EINTR && !stop_copying ())
+	continue;
+      if (n == -1)
+	return false;
+      buf += n;
+      len -= n;
+    }
+  return true;
+}
+
+static copy_result
+copy_rw (int in, int out)
+{
+  while (!stop_copying ())
+    {
+      ssize_t n = read (in, buffer, BUFFER_SIZE);
+      if (n == 0)
+	return COPY_DONE;
+      if (n == -1 && errno == EINTR)
+	continue;
+      if (n == -1 || !write_all (out, buffer, n))
+	return COPY_FAILED;
+    }
+  return COPY_FAILED;
+}
+
+// Copies `in' to `out' until EOF, with the first of the ways to do it
+// that works for these fds.
+static copy_result
+copy_fd (int in, int out)
+{
+  struct stat in_st, out_st;
+  if (fstat (in, &in_st) == -1 || fstat (out, &out_st) == -1)
+    return COPY_FAILED;
+
+  copy_result r = COPY_UNSUPPORTED;
+  if (S_ISREG (in_st.st_mode) && S_ISREG (out_st.st_mode))
+    r = copy_with (move_range, in, out);
+  if (r == COPY_UNSUPPORTED
+      && (S_ISFIFO (in_st.st_mode) || S_ISFIFO (out_st.st_mode)))
+    r = copy_with (move_splice, in, out);
+  if (r == COPY_UNSUPPORTED && S_ISREG (in_st.st_mode))
+    r = copy_with (move_sendfile, in, out);
+  if (r == COPY_UNSUPPORTED)
+    r = copy_rw (in, out);
+  return r;
+}
+
+// Options these don't know are the real command's business.
+static int
+run_external (char **argv)
+{
+  fflush (stdout);
+  pid_t pid = spawn_process (cmdhash_lookup (argv[0]), argv, STDIN_FILENO,
+			     STDOUT_FILENO, NULL, 0);
+  if (pid == -1)
+    {
+      fprintf (stderr, "shell: %s: %s\n", argv[0], strerror (errno));
+      return errno == ENOENT ? 127 : 126;
+    }
+
+  int wstatus;
+  while (waitpid (pid, &wstatus, 0) == -1)
+    if (errno != EINTR)
+      return EXIT_FAILURE;
+  return WIFSIGNALED (wstatus) ? 128 + WTERMSIG (wstatus)
+    : WEXITSTATUS (wstatus);
+}
+
+// Copies `name' (stdin for "-") to stdout. Returns the exit status, or
+// -1 when stdout is gone and there is no point going on.
+static int
+cat_file (const char *name)
+{
+  bool is_stdin = strcmp (name, "-") == 0;
+  int fd = is_stdin ? STDIN_FILENO : open (name, O_RDONLY | O_CLOEXEC);
+  if (fd == -1)
+    {
+      fprintf (stderr, "cat: %s: %s\n", name, strerror (errno));
+      return EXIT_FAILURE;
+    }
+
+  copy_result r = copy_fd (fd, STDOUT_FILENO);
+  int saved_errno = errno;
+  if (!is_stdin)
+    close (fd);
+
+  if (r != COPY_FAILED)
+    return EXIT_SUCCESS;
+  if (saved_errno == EPIPE || interrupted)
+    return -1;
+  fprintf (stderr, "cat: %s: %s\n", name, strerror (saved_errno));
+  return EXIT_FAILURE;
+}
+
+int
+builtin_cat (int argc, char **argv)
+{
+  int i = 1;
+  for (; i < argc && argv[i][0] == '-' && argv[i][1]; i++)
+    if (strcmp (argv[i], "--") == 0)
+      {
+	i++;
+	break;
+      }
+    else if (strcmp (argv[i], "-u") != 0) // unbuffered, as we always are
+      return run_external (argv);
+
+  struct sigaction old;
+  catch_sigint (&old);
+  int status = i == argc ? cat_file ("-") : EXIT_SUCCESS;
+  for (; i < argc && status != -1; i++)
+    {
+      int file_status = cat_file (argv[i]);
+      if (file_status != EXIT_SUCCESS)
+	status = file_status;
+    }
+  stop_catching (&old);
+
+  if (interrupted)
+    return 128 + SIGINT;
+  return status == -1 ? BROKEN_PIPE : status;
+}
+
+// Throws away `len' bytes of `fd'.
+static bool
+discard (int fd, size_t len)
+{
+  while (len > 0)
+    {
+      ssize_t n = read (fd, buffer, len < BUFFER_SIZE ? len : BUFFER_SIZE);
+      if (n == -1 && errno == EINTR && !stop_copying ())
+	continue;
+      if (n <= 0)
+	return false;
+      len -= n;
+    }
+  return true;
+}
+
+// The tee(2) way, for a pipe to a pipe and at most one file: the data
+// is duplicated into stdout, then moved from stdin into the file.
+// Returns COPY_UNSUPPORTED if the fds don't allow it.
+static copy_result
+tee_spliced (int *file, const char *name, int *status)
+{
+  struct stat in_st, out_st, file_st;
+  if (fstat (STDIN_FILENO, &in_st) == -1 || !S_ISFIFO (in_st.st_mode)
+      || fstat (STDOUT_FILENO, &out_st) == -1 || !S_ISFIFO (out_st.st_mode))
+    return COPY_UNSUPPORTED;
+  if (*file == -1)
+    return copy_fd (STDIN_FILENO, STDOUT_FILENO);
+  // splice won't append.
+  if (fstat (*file, &file_st) == -1 || !S_ISREG (file_st.st_mode)
+      || fcntl (*file, F_GETFL) & O_APPEND)
+    return COPY_UNSUPPORTED;
+
+  bool moved = false;
+  while (!stop_copying ())
+    {
+      ssize_t n = tee (STDIN_FILENO, STDOUT_FILENO, CHUNK, 0);
+      if (n == 0)
+	return COPY_DONE;
+      if (n == -1 && errno == EINTR)
+	continue;
+      if (n == -1)
+	return !moved && errno == EINVAL ? COPY_UNSUPPORTED : COPY_FAILED;
+      moved = true;
+
+      // Exactly the n bytes stdout got must leave stdin.
+      size_t left = n;
+      while (left > 0 && *file != -1)
+	{
+	  ssize_t m = splice (STDIN_FILENO, NULL, *file, NULL, left,
+			      SPLICE_F_MOVE);
+	  if (m == -1 && errno == EINTR)
+	    {
+	      if (stop_copying ())
+		return COPY_FAILED;
+	      continue;
+	    }
+	  if (m > 0)
+	    left -= m;
+	  else
+	    {
+	      fprintf (stderr, "tee: %s: %s\n", name,
+		       strerror (m == 0 ? EIO : errno));
+	      *status = EXIT_FAILURE;
+	      close (*file);
+	      *file = -1;
+	    }
+	}
+      if (left > 0 && !discard (STDIN_FILENO, left))
+	return COPY_FAILED;
+      if (*file == -1)
+	return copy_fd (STDIN_FILENO, STDOUT_FILENO);
+    }
+  return COPY_FAILED;
+}
+
+static copy_result
+tee_rw (int *files, char **names, int nfiles, int *status)
+{
+  while (!stop_copying ())
+    {
+      ssize_t n = read (STDIN_FILENO, buffer, BUFFER_SIZE);
+      if (n == 0)
+	return COPY_DONE;
+      if (n == -1 && errno == EINTR)
+	continue;
+      if (n == -1 || !write_all (STDOUT_FILENO, buffer, n))
+	return COPY_FAILED;
+
+      for (int i = 0; i < nfiles; i++)
+	if (files[i] != -1 && !write_all (files[i], buffer, n))
+	  {
+	    if (interrupted)
+	      return COPY_FAILED;
+	    fprintf (stderr, "tee: %s: %s\n", names[i], strerror (errno));
+	    *status = EXIT_FAILURE;
+	    close (files[i]);
+	    files[i] = -1;
+	  }
+    }
+  return COPY_FAILED;
+}
+
+int
+builtin_tee (int argc, char **argv)
+{
+  bool append = false;
+  int i = 1;
+  for (; i < argc && argv[i][0] == '-' && argv[i][1]; i++)
+    if (strcmp (argv[i], "--") == 0)
+      {
+	i++;
+	break;
+      }
+    else if (strcmp (argv[i], "-a") == 0)
+      append = true;
+    else
+      return run_external (argv);
+
+  int status = EXIT_SUCCESS, nfiles = argc - i;
+  char **names = argv + i;
+  int *files = (int *) malloc (sizeof (int) * (nfiles + 1));
+  int flags = O_WRONLY | O_CREAT | O_CLOEXEC | (append ? O_APPEND : O_TRUNC);
+  for (int j = 0; j < nfiles; j++)
+    if ((files[j] = open (names[j], flags, 0666)) == -1)
+      {
+	fprintf (stderr, "tee: %s: %s\n", names[j], strerror (errno));
+	status = EXIT_FAILURE;
+      }
+
+  struct sigaction old;
+  catch_sigint (&old);
+  copy_result r = COPY_UNSUPPORTED;
+  if (nfiles == 0)
+    {
+      files[0] = -1;
+      r = tee_spliced (&files[0], NULL, &status);
+    }
+  else if (nfiles == 1)
+    r = tee_spliced (&files[0], names[0], &status);
+  if (r == COPY_UNSUPPORTED)
+    r = tee_rw (files, names, nfiles, &status);
+  stop_catching (&old);
+
+  if (interrupted)
+    status = 128 + SIGINT;
+  else if (r == COPY_FAILED)
+    {
+      if (errno == EPIPE)
+	status = BROKEN_PIPE;
+      else
+	{
+	  perror ("tee");
+	  status = EXIT_FAILURE;
+	}
+    }
+
+  for (int j = 0; j < nfiles; j++)
+    if (files[j] != -1)
+      close (files[j]);
+  free (files);
+
+  return status;
+}
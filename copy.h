@@ -0,0 +1,41 @@
+/* Copyright (C) 2021 by Alexandru-Sergiu Marton
+
+   This file is part of shell243.
+   
+   shell243 is free software: you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+   
+   shell243 is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+   
+   You should have received a copy of the GNU General Public License
+   along with shell243.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef SH243_COPY_H
+#define SH243_COPY_H
+
+// cat and tee move their data in the kernel where the fds allow it:
+// copy_file_range between regular files, splice when either end is a
+// pipe, sendfile from a regular file, and tee(2) to give a pipe's data
+// to both stdout and the file. Anything else goes through read and
+// write with a large buffer.
+//
+// As a pipeline stage either one runs in the shell itself (see
+// pipe_spawn), so it costs no fork. They catch SIGINT while they
+// copy, so ^C stops them there too. Options they don't know are passed
+// on to the real commands.
+
+// cat [-u] [file | -]...
+int
+builtin_cat (int argc, char **argv);
+
+// tee [-a] [file]...
+int
+builtin_tee (int argc, char **argv);
+
+#endif
@@ -43,6 +43,7 @@ const char *ast_names[] = {
   [AST_AND] = "AST_AND",
   [AST_OR] = "AST_OR",
   [AST_PIPE_SEQ] = "AST_PIPE_SEQ",
+  [AST_TIME] = "AST_TIME",
   [AST_COMMAND] = "AST_COMMAND",
   [AST_WORD] = "AST_WORD",
   [AST_REDIRECT] = "AST_REDIRECT",
@@ -89,10 +90,17 @@ print_ast (ast_node *node, int indent_level)
     putchar ('\t');
 
   printf ("%s, %d children, content: ", ast_names[node->type], node->len);
-  if (node->string != NULL)
-    printf ("%s", node->string);
-  else if (node->type == AST_NUMBER)
+  if (node->type == AST_NUMBER)
     printf ("%d", node->number);
+  else if (node->type == AST_REDIR_OP)
+    printf ("%s", token_names[node->op]);
+  else if (node->type == AST_COMMAND)
+    // The union holds the plan here, not a string.
+    printf ("%d args, %d redirections", node->plan->argc,
+	    node->plan->nredirs);
+  else if ((node->type == AST_WORD || node->type == AST_ERROR)
+	   && node->string != NULL)
+    printf ("%s", node->string);
 
   puts ("");
 
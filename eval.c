@@ -19,358 +19,835 @@
 */
 
 #define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE // wait4
 
 #include <stdlib.h>
 #include <unistd.h>
 #include <stdio.h>
 #include <errno.h>
 #include <sys/wait.h>
-#include <fcntl.h>
 #include <string.h>
 #include <stdbool.h>
+#include <fcntl.h>
 #include <sys/stat.h>
-#include <pwd.h>
 #include <signal.h>
+#include <sys/resource.h>
 
 #include "eval.h"
 #include "job.h"
-#include "debug.h"
+#include "cmdhash.h"
+#include "spawner.h"
+#include "builtins.h"
+#include "reaper.h"
+#include "options.h"
+#include "timing.h"
+#include "stats.h"
+#include "bytecode.h"
+#include "fds.h"
+#include "jobout.h"
+#include "copy.h"
+
+// exit() in a forked child would also "close" the parent's script
+// stream, moving the shared file offset back to where its buffer
+// started.
+static void
+exit_child (int status)
+{
+  fflush (stdout);
+  fflush (stderr);
+  _exit (status);
+}
 
-static int
-eval_builtin_cd (const ast_node *cmd)
+// Points the shell's own fds at the redirect targets of `plan'. If
+// `saved' isn't NULL, the fds that get replaced are kept there for
+// restore_redirects.
+static bool
+apply_redirects (const command_plan *plan, int *saved)
 {
-  if (cmd->len > 2)
-    {
-      errno = EINVAL;
-      perror ("cd");
-      return -1;
-    }
-  else if (cmd->len == 1)
+  for (int i = 0; i < plan->nredirs; i++)
     {
-      struct passwd *pw = getpwuid (getuid ());
-      const char *homedir = pw->pw_dir;
-      if (chdir (homedir) != 0)
+      const redir_action *r = &plan->redirs[i];
+      int fd = open (r->path, r->flags | O_CLOEXEC, S_IRUSR | S_IWUSR);
+      if (fd == -1)
 	{
-	  perror ("cd");
-	  return -1;
+	  perror (r->path);
+	  if (saved)
+	    {
+	      for (int j = i; j < plan->nredirs; j++)
+		saved[j] = -2;
+	    }
+	  return false;
 	}
-    }
-  else
-    {
-      if (chdir (cmd->children[1]->string) != 0)
+
+      if (saved)
+	saved[i] = fd_dup (r->fd);
+      if (fd != r->fd)
 	{
-	  perror ("cd");
-	  return -1;
+	  dup2 (fd, r->fd);
+	  close (fd);
 	}
+      else
+	fcntl (fd, F_SETFD, 0); // the redirect itself is inherited
     }
 
-  return 0;
+  return true;
 }
 
-static int
-eval_builtin_jobs (const ast_node *cmd)
+static void
+restore_redirects (const command_plan *plan, const int *saved)
 {
-  if (cmd->len > 1)
+  for (int i = plan->nredirs - 1; i >= 0; i--)
     {
-      errno = EINVAL;
-      perror ("jobs");
-      return -1;
-    }
-
-  job *j = jobs, *prev = NULL;
-  while (j)
-    {
-      int wstatus;
-      pid_t w = waitpid (j->pid, &wstatus, WNOHANG | WUNTRACED | WCONTINUED);
-
-      if (w == -1)
-	{
-	  perror ("jobs: waitpid");
-	  return -1;
-	}
-      printf ("[%d]+ ", j->jid);
-      if (w == 0)
-	printf ("Running\n");
+      if (saved[i] == -2) // never applied
+	continue;
+      if (saved[i] == -1) // wasn't open before
+	close (plan->redirs[i].fd);
       else
 	{
-	  if (WIFEXITED (wstatus))
-	    {
-	      puts ("Done");
-	      job_remove (&j, &prev);
-	    }
-	  else if (WIFSIGNALED (wstatus))
-	    printf ("Killed by signal %d\n", WTERMSIG (wstatus));
-	  else if (WIFSTOPPED (wstatus))
-	    printf ("Stopped by signal %d\n", WSTOPSIG (wstatus));
-	  else if (WIFCONTINUED (wstatus))
-	    puts ("Continued");
+	  dup2 (saved[i], plan->redirs[i].fd);
+	  close (saved[i]);
 	}
-
-      prev = j;
-      if (j)
-	j = j->next;
     }
+}
 
-  return 0; 
+// The shell's own fds for the pipe sequence being started: the read
+// end of the pipe the stage being launched writes to, the saved stdin
+// and the deferred stage's pipe ends. A builtin forked as a stage
+// never execs, so close-on-exec doesn't apply and it closes them
+// itself, or it would hold its own output's read end and never get
+// EPIPE.
+#define NHELD 4
+static int held_fds[NHELD] = { -1, -1, -1, -1 };
+
+static void
+close_held_fds ()
+{
+  for (int i = 0; i < NHELD; i++)
+    if (held_fds[i] > STDERR_FILENO)
+      close (held_fds[i]);
+}
+
+static pid_t
+timed_fork ()
+{
+  uint64_t start = stat_now ();
+  pid_t pid = fork ();
+  if (pid > 0)
+    stat_record (STAT_FORK, start);
+  return pid;
 }
 
+// Runs a builtin inside the shell, with its redirects applied only for
+// the duration of the call.
 static int
-eval_builtin_exit (const ast_node *cmd)
+run_builtin (builtin_func builtin, const command_plan *plan)
 {
-  if (cmd->len > 2)
-    {
-      errno = EINVAL;
-      perror ("jobs");
-      return -1;
-    }
+  int *saved = NULL;
+  int status = EXIT_FAILURE;
 
-  if (cmd->len == 2)
-    {
-      errno = 0;
-      char *endptr;
-      long retval = strtol (cmd->children[1]->string, &endptr, 10);
+  if (plan->nredirs)
+    saved = (int *) malloc (sizeof (int) * plan->nredirs);
 
-      if (errno != 0)
-	{
-	  perror ("exit: strtol");
-	  return errno;
-	}
-      
-      if (endptr == cmd->children[1]->string)
-	{
-	  errno = EINVAL;
-	  perror ("exit: strtol");
-	  return errno;
-	}
+  fflush (stdout);
+  uint64_t start = stat_now ();
+  if (apply_redirects (plan, saved))
+    status = builtin (plan->argc, plan->argv);
+  fflush (stdout);
+  fflush (stderr);
+  stat_record (STAT_BUILTIN, start);
 
-      exit (retval);
+  if (saved)
+    {
+      restore_redirects (plan, saved);
+      free (saved);
     }
-  else
-    exit (EXIT_SUCCESS);
+
+  return status;
 }
 
-static int
-eval_command (int in_fd, int out_fd, const ast_node *cmd)
-{
-  if (strcmp (cmd->children[0]->string, "cd") == 0)
-    return eval_builtin_cd (cmd);
-  else if (strcmp (cmd->children[0]->string, "jobs") == 0)
-    return eval_builtin_jobs (cmd);
-  else if (strcmp (cmd->children[0]->string, "exit") == 0)
-    return eval_builtin_exit (cmd);
-  
-  pid_t pid = fork ();
+// Runs a builtin in a child process, for pipeline stages that other
+// stages read from.
+static pid_t
+fork_builtin (builtin_func builtin, const command_plan *plan, int in_fd,
+	      int out_fd)
+{
+  fflush (stdout);
+  pid_t pid = timed_fork ();
 
   if (pid == -1)
-    {
-      perror ("shell");
-      return -1;
-    }
+    perror ("shell");
   else if (pid == 0)
     {
       signal (SIGINT, SIG_DFL);
       signal (SIGTSTP, SIG_DFL);
-      
+      signal (SIGPIPE, SIG_DFL);
+      close_held_fds ();
+      reaper_reset ();
+      jobout_reset ();
+
       if (in_fd != STDIN_FILENO)
 	{
 	  dup2 (in_fd, STDIN_FILENO);
 	  close (in_fd);
 	}
-
       if (out_fd != STDOUT_FILENO)
 	{
 	  dup2 (out_fd, STDOUT_FILENO);
 	  close (out_fd);
 	}
 
-      char **argv = (char **) malloc (sizeof (char *) * (cmd->len + 1));
-      int i;
-      for (i = 0; i < cmd->len && cmd->children[i]->type == AST_WORD; i++)
-	argv[i] = cmd->children[i]->string;
+      int status = EXIT_FAILURE;
+      if (apply_redirects (plan, NULL))
+	status = builtin (plan->argc, plan->argv);
+      exit_child (status);
+    }
 
-      argv[i] = NULL;
+  return pid;
+}
 
-      for (; i < cmd->len; i++)
+// Returns the pid of the child to wait for, or 0 if the command ran
+// (or failed to start) without one, with its exit status in *status.
+static pid_t
+eval_command (int in_fd, int out_fd, const command_plan *plan, int *status)
+{
+  builtin_func builtin = builtin_lookup (plan->argv[0]);
+
+  if (builtin)
+    {
+      if (in_fd == STDIN_FILENO && out_fd == STDOUT_FILENO)
 	{
-	  const ast_node *node = cmd->children[i];
-	  // TODO Redirects with specific fds (1> 2> etc.)
-	  const ast_node *operator = node->children[0];
-	  const ast_node *file = node->children[1];
-	  if (operator->type == AST_REDIR_OP)
-	    {
-	      if (strcmp (operator->string, ">") == 0)
-		{
-		  char *output = file->string;
-		  int fd =
-		    open (output, O_CREAT | O_WRONLY, S_IRUSR | S_IWUSR);
-		  dup2 (fd, STDOUT_FILENO);
-		  close (fd);
-		}
-	      else if (strcmp (operator->string, ">>") == 0)
-		{
-		  char *output = file->string;
-		  int fd =
-		    open (output, O_CREAT | O_WRONLY | O_APPEND,
-			  S_IRUSR | S_IWUSR);
-		  dup2 (fd, STDOUT_FILENO);
-		  close (fd);
-		}
-	      else if (strcmp (operator->string, "<") == 0)
-		{
-		  char *input = file->string;
-		  int fd = open (input, O_CREAT | O_RDONLY);
-		  dup2 (fd, STDIN_FILENO);
-		  close (fd);
-		}
-	    }
+	  *status = run_builtin (builtin, plan);
+	  return 0;
 	}
 
-      if (execvp (argv[0], argv))
+      pid_t pid = fork_builtin (builtin, plan, in_fd, out_fd);
+      if (pid == -1)
 	{
-	  perror ("shell");
-	  exit(errno);
+	  *status = EXIT_FAILURE;
+	  pid = 0;
 	}
+      return pid;
+    }
+
+  // Don't let the child inherit (and later flush) our buffered output.
+  fflush (stdout);
+  uint64_t start = stat_now ();
+  pid_t pid = spawn_process (cmdhash_lookup (plan->argv[0]), plan->argv,
+			     in_fd, out_fd, plan->redirs, plan->nredirs);
+  stat_record (STAT_SPAWN, start);
+  if (pid == SPAWN_BAD_REDIRECT)
+    {
+      *status = EXIT_FAILURE;
+      pid = 0;
+    }
+  else if (pid == -1)
+    {
+      fprintf (stderr, "shell: %s: %s\n", plan->argv[0], strerror (errno));
+      *status = errno == ENOENT ? 127 : 126;
+      pid = 0;
     }
 
   return pid;
 }
 
-static int
-eval_pipe_seq (const ast_node *ast)
+// Launches `plan' as timing stage `stage', recording its usage there
+// if it runs in the shell itself.
+static pid_t
+eval_timed (int in_fd, int out_fd, const command_plan *plan, int stage,
+	    int *status)
+{
+  struct rusage before, after;
+  getrusage (RUSAGE_SELF, &before);
+  pid_t pid = eval_command (in_fd, out_fd, plan, status);
+  if (pid == 0) // ran in the shell itself
+    {
+      stage_time *s = &current_timing->stages[stage];
+      getrusage (RUSAGE_SELF, &after);
+      rusage_diff (&s->usage, &after, &before);
+      s->real = elapsed_since (&s->start);
+    }
+
+  return pid;
+}
+
+// Launches `plan', recording its usage in *stage when it is being
+// timed.
+static pid_t
+eval_stage (int in_fd, int out_fd, const command_plan *plan, int *stage,
+	    int *status)
+{
+  if (!current_timing)
+    return eval_command (in_fd, out_fd, plan, status);
+
+  *stage = timing_add_stage (current_timing, plan->argv[0]);
+  return eval_timed (in_fd, out_fd, plan, *stage, status);
+}
+
+// The pipe sequence being run by the interpreter, between its OP_PIPE
+// and its OP_WAIT.
+typedef struct pipeline
+{
+  pid_t *pids; // 0 once reaped, or for stages that ran in the shell
+  int *statuses;
+  int *stages; // indices into current_timing->stages
+  int len, cap, next;
+  int in, stdin_copy;
+  // A cat or tee stage that the shell runs itself once the stages after
+  // it have started, or -1. Its plan is set once it's ready to run, with
+  // the fds it gets for stdin and stdout.
+  int deferred, deferred_in, deferred_out;
+  const command_plan *deferred_plan;
+} pipeline;
+
+// The statuses of the last pipe sequence run in the foreground.
+static int *last_statuses = NULL;
+static int last_len = 0, last_cap = 0;
+
+const int *
+last_pipestatus (int *len)
+{
+  *len = last_len;
+  return last_statuses;
+}
+
+static void
+pipe_begin (pipeline *p, int len, int deferred)
 {
-  pid_t *pids = (pid_t *) malloc (ast->len * sizeof (pid_t));
-  int in = STDIN_FILENO, fildes[2];
-  int stdin_copy = dup (STDIN_FILENO);
-  for (int i = 0; i < ast->len - 1; i++)
+  if (len > p->cap)
     {
-      pipe (fildes);
-      pids[i] = eval_command (in, fildes[1], ast->children[i]);
+      p->cap = len;
+      p->pids = (pid_t *) realloc (p->pids, sizeof (pid_t) * len);
+      p->statuses = (int *) realloc (p->statuses, sizeof (int) * len);
+      p->stages = (int *) realloc (p->stages, sizeof (int) * len);
+    }
+
+  p->len = len;
+  p->next = 0;
+  p->in = STDIN_FILENO;
+  p->deferred = deferred;
+  p->deferred_plan = NULL;
+  // The last stage reads from stdin, which has to be put back after.
+  p->stdin_copy = len > 1 ? fd_dup (STDIN_FILENO) : -1;
+}
+
+static void
+pipe_spawn (pipeline *p, const command_plan *plan)
+{
+  int i = p->next++;
+  p->statuses[i] = EXIT_SUCCESS;
+
+  if (i < p->len - 1)
+    {
+      int fildes[2];
+      if (fd_pipe (fildes) == -1)
+	{
+	  perror ("shell");
+	  p->pids[i] = 0;
+	  p->statuses[i] = EXIT_FAILURE;
+	  return;
+	}
+      if (i == p->deferred)
+	{
+	  // Nothing reads its output yet, so it has to wait for pipe_wait.
+	  p->pids[i] = 0;
+	  // Its timing slot is taken now, so stages keep pipeline order.
+	  if (current_timing)
+	    p->stages[i] = timing_add_stage (current_timing, plan->argv[0]);
+	  p->deferred_plan = plan;
+	  p->deferred_in = p->in;
+	  p->deferred_out = fildes[1];
+	  p->in = fildes[0];
+	  return;
+	}
+      held_fds[0] = fildes[0];
+      held_fds[1] = p->stdin_copy;
+      held_fds[2] = p->deferred_plan ? p->deferred_in : -1;
+      held_fds[3] = p->deferred_plan ? p->deferred_out : -1;
+      p->pids[i] = eval_stage (p->in, fildes[1], plan, &p->stages[i],
+			       &p->statuses[i]);
+      held_fds[0] = held_fds[1] = held_fds[2] = held_fds[3] = -1;
+      // Only the stages may hold pipe ends, or writers wouldn't get
+      // EPIPE and readers wouldn't get EOF.
       close (fildes[1]);
-      in = fildes[0];
+      if (p->in != STDIN_FILENO)
+	close (p->in);
+      p->in = fildes[0];
+      return;
     }
 
-  if (in != STDIN_FILENO)
-    dup2 (in, STDIN_FILENO);
+  if (p->in != STDIN_FILENO)
+    {
+      dup2 (p->in, STDIN_FILENO);
+      close (p->in);
+    }
 
-  pids[ast->len - 1] =
-    eval_command (STDIN_FILENO, STDOUT_FILENO, ast->children[ast->len - 1]);
-  dup2 (stdin_copy, STDIN_FILENO);
-  close (stdin_copy);
+  p->pids[i] = eval_stage (STDIN_FILENO, STDOUT_FILENO, plan, &p->stages[i],
+			   &p->statuses[i]);
+  if (p->stdin_copy != -1)
+    {
+      dup2 (p->stdin_copy, STDIN_FILENO);
+      close (p->stdin_copy);
+    }
+}
+
+// Runs the deferred stage in the shell, between the stages around it.
+static void
+run_deferred (pipeline *p)
+{
+  int i = p->deferred;
+  int saved_in = fd_dup (STDIN_FILENO), saved_out = fd_dup (STDOUT_FILENO);
 
-  int wstatus;
-  for (int i = 0; i < ast->len; i++)
+  fflush (stdout);
+  if (p->deferred_in != STDIN_FILENO)
     {
-      wstatus = 0;
-      if (pids[i] > 0) // Negative PIDs mean something went wrong, so don't wait.
-	waitpid (pids[i], &wstatus, 0);
+      dup2 (p->deferred_in, STDIN_FILENO);
+      close (p->deferred_in);
     }
+  dup2 (p->deferred_out, STDOUT_FILENO);
+  close (p->deferred_out);
 
-  free (pids);
+  if (current_timing)
+    {
+      stage_time *s = &current_timing->stages[p->stages[i]];
+      clock_gettime (CLOCK_MONOTONIC, &s->start);
+      eval_timed (STDIN_FILENO, STDOUT_FILENO, p->deferred_plan, p->stages[i],
+		  &p->statuses[i]);
+    }
+  else
+    eval_command (STDIN_FILENO, STDOUT_FILENO, p->deferred_plan,
+		  &p->statuses[i]);
 
-  return WEXITSTATUS (wstatus);
+  if (saved_in != -1)
+    {
+      dup2 (saved_in, STDIN_FILENO);
+      close (saved_in);
+    }
+  if (saved_out != -1)
+    {
+      dup2 (saved_out, STDOUT_FILENO);
+      close (saved_out);
+    }
 }
 
+typedef struct stage_pid
+{
+  pid_t pid;
+  int stage;
+} stage_pid;
+
 static int
-eval_and_or (const ast_node *ast)
+compare_stage_pids (const void *a, const void *b)
+{
+  pid_t x = ((const stage_pid *) a)->pid, y = ((const stage_pid *) b)->pid;
+  return (x > y) - (x < y);
+}
+
+// set -o failfast: once a stage fails the others are doomed, so they
+// are stopped instead of left to finish their work.
+static void
+stop_stages (pipeline *p)
 {
-  int result;
-  if (ast->type == AST_AND)
+  for (int i = 0; i < p->len; i++)
+    if (p->pids[i] > 0)
+      kill (p->pids[i], SIGTERM);
+}
+
+static void
+stage_exited (pipeline *p, int i, int wstatus, const struct rusage *usage)
+{
+  p->pids[i] = 0;
+  p->statuses[i] = WIFSIGNALED (wstatus) ? 128 + WTERMSIG (wstatus)
+    : WEXITSTATUS (wstatus);
+  if (current_timing)
     {
-      result = eval (ast->children[0]);
-      if (result == 0)
-	return eval (ast->children[1]);
+      stage_time *stage = &current_timing->stages[p->stages[i]];
+      stage->usage = *usage;
+      stage->real = elapsed_since (&stage->start);
     }
-  else
+}
+
+// Reaps the stages in the order they finish, which also picks up any
+// background job that finishes meanwhile.
+static int
+pipe_wait (pipeline *p)
+{
+  if (p->deferred_plan)
+    run_deferred (p);
+
+  uint64_t start = stat_now ();
+  stage_pid *running = (stage_pid *) malloc (sizeof (stage_pid) * p->len);
+  int left = 0;
+  bool stopped = false;
+
+  for (int i = 0; i < p->len; i++)
+    {
+      // A builtin in the shell may have reaped some stages already.
+      int wstatus;
+      struct rusage usage;
+      if (p->pids[i] > 0 && reaper_claim (p->pids[i], &wstatus, &usage))
+	stage_exited (p, i, wstatus, &usage);
+
+      if (p->pids[i] > 0)
+	running[left++] = (stage_pid) { p->pids[i], i };
+      else if (p->statuses[i] != 0 && options.failfast)
+	stopped = true;
+    }
+  qsort (running, left, sizeof (stage_pid), compare_stage_pids);
+  int nrunning = left;
+
+  if (stopped)
+    stop_stages (p);
+
+  while (left > 0)
+    {
+      int wstatus;
+      struct rusage usage;
+      pid_t pid;
+      if (jobout_fd () != -1)
+	{
+	  // Background jobs mustn't block on their output for as long
+	  // as this pipe sequence runs.
+	  reaper_clear ();
+	  pid = wait4 (-1, &wstatus, WNOHANG, &usage);
+	  if (pid == 0)
+	    {
+	      jobout_wait (reaper_fd ());
+	      continue;
+	    }
+	}
+      else
+	pid = wait4 (-1, &wstatus, 0, &usage);
+      if (pid == -1)
+	{
+	  if (errno == EINTR)
+	    continue;
+	  break;
+	}
+
+      stage_pid key = { pid, 0 };
+      stage_pid *found = (stage_pid *) bsearch (&key, running, nrunning,
+						sizeof (stage_pid),
+						compare_stage_pids);
+      if (!found)
+	{
+	  reaper_dispatch (pid, wstatus);
+	  continue;
+	}
+
+      int i = found->stage;
+      left--;
+      stage_exited (p, i, wstatus, &usage);
+
+      if (p->statuses[i] != 0 && options.failfast && !stopped)
+	{
+	  stopped = true;
+	  stop_stages (p);
+	}
+    }
+
+  free (running);
+  stat_record (STAT_WAIT, start);
+
+  if (last_cap < p->len)
     {
-      result = eval (ast->children[0]);
-      if (result != 0)
-	return eval (ast->children[1]);
+      last_cap = p->len;
+      last_statuses = (int *) realloc (last_statuses, sizeof (int) * last_cap);
     }
-  return 0;
+  memcpy (last_statuses, p->statuses, sizeof (int) * p->len);
+  last_len = p->len;
+
+  int status = p->statuses[p->len - 1];
+  if (options.pipefail)
+    for (int i = p->len - 1; i >= 0 && status == 0; i--)
+      status = p->statuses[i];
+
+  return status;
 }
 
-int
-eval_program (const ast_node *ast)
-{
-  int retval = EXIT_SUCCESS;
-
-  for (int i = 0; i < ast->len; i++)
-    if (ast->children[i]->type != AST_SEMI
-	&& ast->children[i]->type != AST_AMP)
-      {
-	if (ast->len > i + 1 && ast->children[i + 1]->type == AST_AMP)
-	  {
-	    pid_t pid;
-
-	    pid = fork ();
-	    if (pid == -1)
-	      {
-		perror ("shell");
-		return errno;
-	      }
-	    else if (pid == 0)
-	      {
-		free_jobs ();
-		exit (eval (ast->children[i]));
-	      }
-	    else
-	      {
-		job_add (pid);
-		printf ("[%d] %d\n", last_jid, pid);
-		retval = EXIT_SUCCESS;
-	      }
-	  }
-	else // foreground process
-	  retval = eval (ast->children[i]);
-      }
-
-  check_bg_processes ();
-
-  return retval;
+// A "time" being run by the interpreter.
+typedef struct time_frame
+{
+  timing t;
+  timing *outer;
+  struct timespec start;
+} time_frame;
+
+static void
+time_begin (time_frame *f)
+{
+  f->t = (timing) { NULL, 0, 0 };
+  f->outer = current_timing;
+  current_timing = &f->t;
+  clock_gettime (CLOCK_MONOTONIC, &f->start);
 }
 
-int
-eval (const ast_node *ast)
+static void
+time_end (time_frame *f)
 {
-  switch (ast->type)
+  double real = elapsed_since (&f->start);
+  current_timing = f->outer;
+  timing_report (&f->t, real);
+  timing_free (&f->t);
+}
+
+// Forks a background job. The child is left with no jobs of its own.
+// Under set -o jobout its stdout and stderr go to a pipe, the read end
+// of which is left in `*capture' for jobout_add; otherwise that's -1.
+static pid_t
+fork_job (int *capture)
+{
+  int out[2];
+  bool collect = jobout_pipe (out);
+  *capture = -1;
+
+  fflush (stdout);
+  pid_t pid = timed_fork ();
+  if (pid == -1)
+    perror ("shell");
+  else if (pid == 0)
+    {
+      forget_jobs ();
+      reaper_reset ();
+      jobout_reset ();
+      signal (SIGPIPE, SIG_DFL);
+      if (collect)
+	{
+	  dup2 (out[1], STDOUT_FILENO);
+	  dup2 (out[1], STDERR_FILENO);
+	  close (out[0]);
+	  close (out[1]);
+	}
+      return pid;
+    }
+
+  if (collect)
     {
-    case AST_PROGRAM:
-      return eval_program (ast);
-    case AST_AND:
-    case AST_OR:
-      return eval_and_or (ast);
-    case AST_PIPE_SEQ:
-      return eval_pipe_seq (ast);
-    default:
-      fprintf (stderr, "Unexpected AST node: %s",
-	       ast_type_to_string (ast->type));
-      return -1;
+      close (out[1]);
+      if (pid > 0)
+	*capture = out[0];
+      else
+	close (out[0]);
     }
+
+  return pid;
+}
+
+static pid_t
+fork_background (const ast_node *ast, int *capture)
+{
+  pid_t pid = fork_job (capture);
+  if (pid == 0)
+    exit_child (eval (ast));
+
+  return pid;
+}
+
+static bool
+can_start_job ()
+{
+  return options.maxjobs == 0 || job_active_count () < options.maxjobs;
 }
 
 void
-check_bg_processes ()
+start_queued_jobs ()
 {
-  job *j = jobs, *prev = NULL;
-  while (j)
+  job *j;
+  while ((j = job_first_queued ()) && can_start_job ())
     {
-      int wstatus = 0;
-      pid_t pid = waitpid (j->pid, &wstatus, WNOHANG);
-
+      int capture;
+      pid_t pid = fork_background (j->command, &capture);
       if (pid == -1)
+	break;
+      job_start (j, pid);
+      if (capture != -1)
+	jobout_add (j->jid, capture);
+      arena_release (j->storage);
+      free (j->storage);
+      j->storage = NULL;
+      j->command = NULL;
+    }
+}
+
+void
+finish_queued_jobs ()
+{
+  start_queued_jobs ();
+  while (job_first_queued ())
+    {
+      if (jobout_fd () != -1)
 	{
-	  printf ("fucked up with pid: %d, job %d\n", j->pid, j->jid);
-	  perror ("check_bg_processes: waitpid");
-	  return;
+	  // The running jobs may be blocked on their output.
+	  jobout_wait (reaper_fd ());
+	  reap_children ();
 	}
+      else
+	{
+	  int wstatus;
+	  pid_t pid = waitpid (-1, &wstatus, 0);
+	  if (pid == -1 && errno != EINTR)
+	    break;
+	  if (pid > 0)
+	    reaper_dispatch (pid, wstatus);
+	}
+      start_queued_jobs ();
+    }
+}
 
-      if (pid)
+// Starts `ast' in the background, or queues it if set -o maxjobs
+// doesn't allow another job. Returns true in the job's child.
+static bool
+start_background (const ast_node *ast)
+{
+  reap_children ();
+  start_queued_jobs ();
+  if (!job_first_queued () && can_start_job ())
+    {
+      int capture;
+      pid_t pid = fork_job (&capture);
+      if (pid == 0)
+	return true;
+      if (pid > 0)
 	{
-	  printf ("[%d]+ Done\n", j->jid);
-	  job_remove (&j, &prev);
+	  job *j = job_add (pid);
+	  if (capture != -1)
+	    jobout_add (j->jid, capture);
+	  printf ("[%d] %d\n", j->jid, pid);
 	}
-      prev = j;
-      if (j)
-	j = j->next;
     }
+  else
+    {
+      // The tree goes away with the line, so the job needs a copy.
+      arena *storage = (arena *) calloc (1, sizeof (arena));
+      storage->chunk_size = 1024;
+      job *j = job_queue (ast_clone (storage, ast), storage);
+      printf ("[%d] queued\n", j->jid);
+    }
+
+  return false;
+}
+
+// Picks the stage of the pipe sequence starting at `pc' that the shell
+// can run itself: a cat or tee that isn't last. Only if no other stage
+// is a builtin, since a forked one would hold on to its pipe ends and
+// one in the shell would have to wait for it. The sequence's OP_SPAWNs
+// follow its OP_PIPE.
+static int
+deferred_stage (const bytecode *bc, int pc)
+{
+  int len = bc->code[pc].a, stage = -1;
+  for (int i = 0; i < len; i++)
+    {
+      const command_plan *plan = bc->pool[bc->code[pc + 1 + i].a].plan;
+      builtin_func builtin = builtin_lookup (plan->argv[0]);
+      if (!builtin)
+	continue;
+      if (stage != -1 || i == len - 1
+	  || (builtin != builtin_cat && builtin != builtin_tee))
+	return -1;
+      stage = i;
+    }
+
+  return stage;
+}
+
+static int
+run (const bytecode *bc)
+{
+  int status = EXIT_SUCCESS, end = bc->len;
+  bool in_job = false;
+  pipeline p = { 0 };
+  time_frame *frames = NULL;
+  int nframes = 0, frames_cap = 0;
+
+  for (int pc = 0; pc < end; pc++)
+    {
+      const instruction *ins = &bc->code[pc];
+      switch (ins->op)
+	{
+	case OP_PIPE:
+	  pipe_begin (&p, ins->a, deferred_stage (bc, pc));
+	  break;
+	case OP_SPAWN:
+	  pipe_spawn (&p, bc->pool[ins->a].plan);
+	  break;
+	case OP_WAIT:
+	  status = pipe_wait (&p);
+	  break;
+	case OP_JUMP_IF_FAIL:
+	  if (status != 0)
+	    pc = ins->a - 1;
+	  break;
+	case OP_JUMP_IF_OK:
+	  if (status == 0)
+	    pc = ins->a - 1;
+	  break;
+	case OP_BACKGROUND:
+	  if (start_background (bc->pool[ins->a].node))
+	    {
+	      // The child runs the job's code and nothing after it.
+	      in_job = true;
+	      end = ins->b;
+	    }
+	  else
+	    {
+	      status = EXIT_SUCCESS;
+	      pc = ins->b - 1;
+	    }
+	  break;
+	case OP_TIME:
+	  if (nframes == frames_cap)
+	    {
+	      frames_cap = frames_cap ? frames_cap * 2 : 4;
+	      frames = (time_frame *) realloc (frames, sizeof (time_frame)
+					       * frames_cap);
+	    }
+	  time_begin (&frames[nframes++]);
+	  break;
+	case OP_TIME_END:
+	  time_end (&frames[--nframes]);
+	  break;
+	}
+    }
+
+  if (in_job)
+    exit_child (status);
+
+  free (frames);
+  free (p.pids);
+  free (p.statuses);
+  free (p.stages);
+
+  return status;
+}
+
+int
+eval (const ast_node *ast)
+{
+  bytecode bc = { 0 };
+  compile (&bc, ast);
+  int status = run (&bc);
+  bytecode_free (&bc);
+
+  if (ast->type == AST_PROGRAM)
+    check_bg_processes ();
+
+  return status;
+}
+
+void
+check_bg_processes ()
+{
+  uint64_t start = stat_now ();
+  reap_children ();
+  start_queued_jobs ();
+  jobout_drain ();
+
+  job *j;
+  while ((j = job_pop_done ()))
+    {
+      printf ("[%d]+ Done\n", j->jid);
+      job_remove (j);
+    }
+
+  stat_record (STAT_REAP, start);
 }
@@ -30,4 +30,17 @@ eval (const ast_node *ast);
 void
 check_bg_processes ();
 
+// The exit status of each stage of the last pipe sequence run in the
+// foreground, 128 + the signal for stages killed by one.
+const int *
+last_pipestatus (int *len);
+
+// Starts queued background jobs while set -o maxjobs allows it.
+void
+start_queued_jobs ();
+
+// Waits until every queued job has been started.
+void
+finish_queued_jobs ();
+
 #endif
@@ -0,0 +1,78 @@
+/* Copyright (C) 2021 by Alexandru-Sergiu Marton
+
+   This file is part of shell243.
+   
+   shell243 is free software: you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+   
+   shell243 is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+   
+   You should have received a copy of the GNU General Public License
+   along with shell243.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#define _GNU_SOURCE // pipe2, syscall
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <errno.h>
+#include <sys/syscall.h>
+
+#include "fds.h"
+
+int
+fd_pipe (int fildes[2])
+{
+  return pipe2 (fildes, O_CLOEXEC);
+}
+
+int
+fd_dup (int fd)
+{
+  return fcntl (fd, F_DUPFD_CLOEXEC, 10);
+}
+
+int
+fd_pidfd (pid_t pid)
+{
+#ifdef SYS_pidfd_open
+  return syscall (SYS_pidfd_open, pid, 0);
+#else
+  (void) pid;
+  errno = ENOSYS;
+  return -1;
+#endif
+}
+
+#ifdef DEBUG
+void
+fd_check_inherited (const char *name, int in_fd, int out_fd)
+{
+  DIR *dir = opendir ("/proc/self/fd");
+  if (!dir)
+    return;
+
+  struct dirent *entry;
+  while ((entry = readdir (dir)))
+    {
+      int fd = atoi (entry->d_name);
+      if (entry->d_name[0] == '.' || fd <= STDERR_FILENO || fd == in_fd
+	  || fd == out_fd || fd == dirfd (dir))
+	continue;
+
+      int flags = fcntl (fd, F_GETFD);
+      if (flags != -1 && !(flags & FD_CLOEXEC))
+	fprintf (stderr, "shell: fd %d leaks into %s\n", fd, name);
+    }
+
+  closedir (dir);
+}
+#endif
@@ -0,0 +1,50 @@
+/* Copyright (C) 2021 by Alexandru-Sergiu Marton
+
+   This file is part of shell243.
+   
+   shell243 is free software: you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+   
+   shell243 is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+   
+   You should have received a copy of the GNU General Public License
+   along with shell243.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef SH243_FDS_H
+#define SH243_FDS_H
+
+#include <sys/types.h>
+
+// Every fd the shell opens for its own use is close-on-exec, so that a
+// command inherits nothing but its stdin, stdout and stderr and the
+// redirects in its plan. A pipe write end left open in a command would
+// keep the reader from ever seeing EOF.
+
+// pipe, with both ends close-on-exec.
+int
+fd_pipe (int fildes[2]);
+
+// A close-on-exec copy of `fd', out of the way of the fds that
+// redirects name (10 and up).
+int
+fd_dup (int fd);
+
+// A pidfd for `pid' (close-on-exec, like every pidfd), or -1 if the
+// kernel has none to give.
+int
+fd_pidfd (pid_t pid);
+
+#ifdef DEBUG
+// Complains about every fd other than 0-2, `in_fd' and `out_fd' that a
+// command spawned now would inherit.
+void
+fd_check_inherited (const char *name, int in_fd, int out_fd);
+#endif
+
+#endif
@@ -16,73 +16,309 @@
    along with shell243.  If not, see <https://www.gnu.org/licenses/>.
 */
 
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
 
 #include "job.h"
+#include "arena.h"
 
-int last_jid = 0;
-job *jobs = NULL;
+// slots[jid - 1] is the job with that id, or NULL.
+static job **slots = NULL;
+static int nslots = 0, slots_cap = 0, njobs = 0;
 
-void
-job_add (pid_t pid)
+// Ids below nslots that were given back, reused most recent first.
+static int *free_jids = NULL;
+static int nfree = 0;
+
+// Open addressing with linear probing, from pid to job.
+static job **pid_table = NULL;
+static size_t pid_cap = 0;
+
+// Jobs that finished and haven't been reported yet, oldest first.
+static job *done_head = NULL, *done_tail = NULL;
+
+static job *queue_head = NULL, *queue_tail = NULL;
+static int nactive = 0;
+
+static size_t
+pid_slot (pid_t pid)
 {
-  job *j = (job *) malloc (sizeof (job));
-  j->pid = pid;
-  j->jid = ++last_jid;
-  j->next = NULL;
-  
-  if (jobs == NULL)
+  return ((size_t) pid * 2654435761u) & (pid_cap - 1);
+}
+
+static void
+pid_insert (job *j)
+{
+  size_t i = pid_slot (j->pid);
+  while (pid_table[i])
+    i = (i + 1) & (pid_cap - 1);
+  pid_table[i] = j;
+}
+
+static void
+pid_grow ()
+{
+  job **old = pid_table;
+  size_t old_cap = pid_cap;
+
+  pid_cap = pid_cap ? pid_cap * 2 : 64;
+  pid_table = (job **) calloc (pid_cap, sizeof (job *));
+  for (size_t i = 0; i < old_cap; i++)
+    if (old[i])
+      pid_insert (old[i]);
+  free (old);
+}
+
+static void
+pid_delete (job *j)
+{
+  size_t i = pid_slot (j->pid);
+  while (pid_table[i] != j)
+    i = (i + 1) & (pid_cap - 1);
+  pid_table[i] = NULL;
+
+  // Shift later entries of the probe run back so lookups don't stop
+  // at the hole.
+  for (size_t k = (i + 1) & (pid_cap - 1); pid_table[k];
+       k = (k + 1) & (pid_cap - 1))
     {
-      jobs = j;
+      size_t home = pid_slot (pid_table[k]->pid);
+      if (((k - home) & (pid_cap - 1)) >= ((k - i) & (pid_cap - 1)))
+	{
+	  pid_table[i] = pid_table[k];
+	  pid_table[k] = NULL;
+	  i = k;
+	}
     }
+}
+
+static job *
+new_job ()
+{
+  job *j = (job *) malloc (sizeof (job));
+  j->pid = 0;
+  j->state = JOB_QUEUED;
+  j->status = 0;
+  j->prev_done = j->next_done = NULL;
+  j->queued_done = false;
+  j->command = NULL;
+  j->storage = NULL;
+  j->next_queued = NULL;
+
+  if (nfree)
+    j->jid = free_jids[--nfree];
   else
     {
-      job *last = jobs;
-      while (last->next != NULL)
-	last = last->next;
-      last->next = j;
+      if (nslots == slots_cap)
+	{
+	  slots_cap = slots_cap ? slots_cap * 2 : 16;
+	  slots = (job **) realloc (slots, sizeof (job *) * slots_cap);
+	  free_jids = (int *) realloc (free_jids, sizeof (int) * slots_cap);
+	}
+      j->jid = ++nslots;
     }
+  slots[j->jid - 1] = j;
+  njobs++;
+
+  return j;
 }
 
 void
-job_remove (job **j, job **prev)
+job_start (job *j, pid_t pid)
 {
-  if (!j || !prev) // crash if bad parameters (future me won't like that)
-    exit (EXIT_FAILURE);
-  
-  job *next = (*j)->next;
+  if (j->state == JOB_QUEUED)
+    {
+      // Jobs are always started from the head of the queue.
+      queue_head = j->next_queued;
+      if (!queue_head)
+	queue_tail = NULL;
+      j->next_queued = NULL;
+    }
 
-  free (*j);
+  j->pid = pid;
+  j->state = JOB_RUNNING;
+  nactive++;
 
-  if (*prev)
-    (*prev)->next = next;
+  if ((size_t) (njobs + 1) * 2 > pid_cap)
+    pid_grow ();
+  pid_insert (j);
+}
+
+job *
+job_add (pid_t pid)
+{
+  job *j = new_job ();
+  job_start (j, pid);
+  return j;
+}
+
+job *
+job_queue (struct ast_node *command, struct arena *storage)
+{
+  job *j = new_job ();
+  j->command = command;
+  j->storage = storage;
+  if (queue_tail)
+    queue_tail->next_queued = j;
   else
-    jobs = next;
-  *j = next;
+    queue_head = j;
+  queue_tail = j;
 
-  if (!next)
+  return j;
+}
+
+job *
+job_first_queued ()
+{
+  return queue_head;
+}
+
+int
+job_active_count ()
+{
+  return nactive;
+}
+
+static void
+free_storage (job *j)
+{
+  if (j->storage)
+    {
+      arena_release (j->storage);
+      free (j->storage);
+      j->storage = NULL;
+      j->command = NULL;
+    }
+}
+
+job *
+job_find (pid_t pid)
+{
+  if (!pid_cap)
+    return NULL;
+
+  size_t i = pid_slot (pid);
+  while (pid_table[i] && pid_table[i]->pid != pid)
+    i = (i + 1) & (pid_cap - 1);
+  return pid_table[i];
+}
+
+job *
+job_get (int jid)
+{
+  if (jid < 1 || jid > nslots)
+    return NULL;
+  return slots[jid - 1];
+}
+
+static void
+unlink_done (job *j)
+{
+  if (j->prev_done)
+    j->prev_done->next_done = j->next_done;
+  else
+    done_head = j->next_done;
+  if (j->next_done)
+    j->next_done->prev_done = j->prev_done;
+  else
+    done_tail = j->prev_done;
+
+  j->prev_done = j->next_done = NULL;
+  j->queued_done = false;
+}
+
+void
+job_remove (job *j)
+{
+  if (j->queued_done)
+    unlink_done (j);
+  if (j->state == JOB_QUEUED)
     {
-      if (*prev)
-	last_jid = (*prev)->jid;
+      job *prev = NULL;
+      for (job *q = queue_head; q != j; q = q->next_queued)
+	prev = q;
+      if (prev)
+	prev->next_queued = j->next_queued;
       else
-	{
-	  last_jid = 0;
-	  jobs = NULL;
-	}
+	queue_head = j->next_queued;
+      if (queue_tail == j)
+	queue_tail = prev;
     }
+  else
+    pid_delete (j);
+  if (j->state == JOB_RUNNING || j->state == JOB_STOPPED)
+    nactive--;
+  free_storage (j);
+  slots[j->jid - 1] = NULL;
+  free_jids[nfree++] = j->jid;
+  njobs--;
+  free (j);
+
+  // Once every job is gone, ids start over from 1.
+  if (njobs == 0)
+    nslots = nfree = 0;
 }
 
 void
-free_jobs ()
+job_update (job *j, int wstatus)
 {
-  job *j = jobs;
-  while (j != NULL)
+  j->status = wstatus;
+  if (WIFSTOPPED (wstatus))
+    j->state = JOB_STOPPED;
+  else if (WIFCONTINUED (wstatus))
+    j->state = JOB_RUNNING;
+  else if (j->state != JOB_DONE)
     {
-      job *aux = j->next;
-      free (j);
-      j = aux;
+      j->state = JOB_DONE;
+      nactive--;
+      j->queued_done = true;
+      j->prev_done = done_tail;
+      if (done_tail)
+	done_tail->next_done = j;
+      else
+	done_head = j;
+      done_tail = j;
     }
+}
 
-  last_jid = 0;
-  jobs = NULL;
+job *
+job_pop_done ()
+{
+  job *j = done_head;
+  if (j)
+    unlink_done (j);
+  return j;
+}
+
+job *
+job_next (const job *j)
+{
+  for (int jid = j ? j->jid + 1 : 1; jid <= nslots; jid++)
+    if (slots[jid - 1])
+      return slots[jid - 1];
+  return NULL;
+}
+
+int
+job_count ()
+{
+  return njobs;
+}
+
+void
+forget_jobs ()
+{
+  // Subshells exit soon anyway: freeing every job (and queued command)
+  // would only fault in and copy the pages they live on.
+  slots = NULL;
+  free_jids = NULL;
+  pid_table = NULL;
+  nslots = slots_cap = njobs = nfree = 0;
+  pid_cap = 0;
+  done_head = done_tail = NULL;
+  queue_head = queue_tail = NULL;
+  nactive = 0;
 }
@@ -19,25 +19,79 @@
 #ifndef SH243_JOB_H
 #define SH243_JOB_H
 
+#include <stdbool.h>
 #include <sys/types.h>
 
+typedef enum job_state
+  {
+    JOB_QUEUED,
+    JOB_RUNNING,
+    JOB_STOPPED,
+    JOB_DONE
+  } job_state;
+
 typedef struct job
 {
   pid_t pid;
   int jid;
-  struct job *next;
+  job_state state;
+  int status; // wait status, once the job is stopped or done
+  struct job *prev_done, *next_done;
+  bool queued_done;
+  // A queued job keeps its own copy of the command until it starts.
+  struct ast_node *command;
+  struct arena *storage;
+  struct job *next_queued;
 } job;
 
-extern int last_jid;
-extern job *jobs;
+// Jobs live in a table indexed by job id, with a hash from pid to job
+// and a free list of ids, so none of these walk the other jobs.
 
-void
+job *
 job_add (pid_t pid);
 
+// Adds a job that will be started later by job_start, in the order
+// they were queued.
+job *
+job_queue (struct ast_node *command, struct arena *storage);
+
+job *
+job_first_queued ();
+
+void
+job_start (job *j, pid_t pid);
+
+// Jobs that were started and aren't done yet.
+int
+job_active_count ();
+
+job *
+job_find (pid_t pid);
+
+job *
+job_get (int jid);
+
+void
+job_remove (job *j);
+
+// Records a state change reported by waitpid. Jobs that are done are
+// queued for job_pop_done.
 void
-job_remove (job **j, job **prev);
+job_update (job *j, int wstatus);
+
+job *
+job_pop_done ();
+
+// Iterates over the jobs in order of job id: job_next (NULL) is the
+// first job.
+job *
+job_next (const job *j);
+
+int
+job_count ();
 
+// Empties the table in a forked subshell.
 void
-free_jobs ();
+forget_jobs ();
 
 #endif
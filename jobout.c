@@ -0,0 +1,294 @@
+/* Copyright (C) 2021 by Alexandru-Sergiu Marton
+
+   This file is part of shell243.
+   
+   shell243 is free software: you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+   
+   shell243 is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+   
+   You should have received a copy of the GNU General Public License
+   along with shell243.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+
+#include "jobout.h"
+#include "options.h"
+#include "fds.h"
+
+typedef struct capture
+{
+  int jid;
+  int fd; // -1 once the job has closed its end
+  jobout_mode mode;
+  char *buf;
+  size_t len, cap;
+  bool held; // full, and left unread until it's this job's turn
+  struct capture *next;
+} capture;
+
+// In the order the jobs were started.
+static capture *captures = NULL;
+// The group job whose output is being printed, if any.
+static capture *owner = NULL;
+static int epoll_fd = -1;
+
+static void
+watch (capture *c)
+{
+  struct epoll_event ev = { .events = EPOLLIN, .data.ptr = c };
+  if (epoll_ctl (epoll_fd, EPOLL_CTL_ADD, c->fd, &ev) == -1)
+    perror ("shell: epoll_ctl");
+}
+
+static void
+unwatch (capture *c)
+{
+  epoll_ctl (epoll_fd, EPOLL_CTL_DEL, c->fd, NULL);
+}
+
+static void
+close_capture (capture *c)
+{
+  if (!c->held)
+    unwatch (c);
+  close (c->fd);
+  c->fd = -1;
+}
+
+static void
+free_capture (capture *c)
+{
+  capture **link = &captures;
+  while (*link != c)
+    link = &(*link)->next;
+  *link = c->next;
+
+  if (c->fd != -1)
+    close_capture (c);
+  if (owner == c)
+    owner = NULL;
+  free (c->buf);
+  free (c);
+}
+
+bool
+jobout_pipe (int fildes[2])
+{
+  if (options.jobout == JOBOUT_OFF)
+    return false;
+
+  if (epoll_fd == -1 && (epoll_fd = epoll_create1 (EPOLL_CLOEXEC)) == -1)
+    {
+      perror ("shell: epoll_create1");
+      return false;
+    }
+  if (fd_pipe (fildes) == -1)
+    {
+      perror ("shell: pipe");
+      return false;
+    }
+  return true;
+}
+
+void
+jobout_add (int jid, int fd)
+{
+  capture *c = (capture *) calloc (1, sizeof (capture));
+  c->jid = jid;
+  c->fd = fd;
+  c->mode = options.jobout;
+  c->cap = (size_t) options.jobbuf * 1024;
+  if (c->cap < PIPE_BUF)
+    c->cap = PIPE_BUF;
+  c->buf = (char *) malloc (c->cap);
+  fcntl (fd, F_SETFL, O_NONBLOCK);
+
+  capture **link = &captures;
+  while (*link)
+    link = &(*link)->next;
+  *link = c;
+  watch (c);
+}
+
+int
+jobout_fd ()
+{
+  return captures ? epoll_fd : -1;
+}
+
+// Prints every whole line in the buffer. A line as long as the buffer,
+// or the last one of a job that didn't end it, is printed as it is.
+static void
+emit_lines (capture *c)
+{
+  char *start = c->buf, *end = c->buf + c->len, *newline;
+  while ((newline = (char *) memchr (start, '\n', end - start)))
+    {
+      printf ("[%d] %.*s\n", c->jid, (int) (newline - start), start);
+      start = newline + 1;
+    }
+
+  if (start < end && (c->fd == -1 || (start == c->buf && c->len == c->cap)))
+    {
+      printf ("[%d] %.*s\n", c->jid, (int) (end - start), start);
+      start = end;
+    }
+
+  c->len = end - start;
+  memmove (c->buf, start, c->len);
+}
+
+// Hands the output over to the next group job: jobs that are done
+// first, then the oldest one that has written something.
+static void
+next_owner ()
+{
+  while (!owner)
+    {
+      capture *pick = NULL;
+      for (capture *c = captures; c; c = c->next)
+	if (c->mode == JOBOUT_GROUP && c->len > 0
+	    && (!pick || (c->fd == -1 && pick->fd != -1)))
+	  pick = c;
+      if (!pick)
+	return;
+
+      fwrite (pick->buf, 1, pick->len, stdout);
+      pick->len = 0;
+      if (pick->fd == -1)
+	free_capture (pick);
+      else
+	{
+	  owner = pick;
+	  if (pick->held)
+	    {
+	      pick->held = false;
+	      watch (pick);
+	    }
+	}
+    }
+}
+
+static void
+read_capture (capture *c)
+{
+  ssize_t n = read (c->fd, c->buf + c->len, c->cap - c->len);
+  if (n == -1 && (errno == EAGAIN || errno == EINTR))
+    return;
+  if (n > 0)
+    c->len += n;
+  else
+    close_capture (c);
+
+  if (c->mode == JOBOUT_LINES)
+    emit_lines (c);
+  else if (!owner || owner == c)
+    {
+      owner = c;
+      fwrite (c->buf, 1, c->len, stdout);
+      c->len = 0;
+    }
+  else if (c->len == c->cap && c->fd != -1)
+    {
+      // Back-pressure: the job blocks once its pipe fills up too.
+      c->held = true;
+      unwatch (c);
+    }
+
+  if (c->fd == -1 && c->len == 0)
+    {
+      bool was_owner = owner == c;
+      free_capture (c);
+      if (was_owner)
+	next_owner ();
+    }
+}
+
+void
+jobout_drain ()
+{
+  if (!captures)
+    return;
+
+  // Every event is for a job that is still open, and only jobs that
+  // are closed get freed along the way, so none of these go stale.
+  struct epoll_event events[16];
+  int n = epoll_wait (epoll_fd, events, 16, 0);
+  for (int i = 0; i < n; i++)
+    read_capture ((capture *) events[i].data.ptr);
+
+  fflush (stdout);
+}
+
+void
+jobout_wait (int fd)
+{
+  struct pollfd fds[2] = {
+    { .fd = fd, .events = POLLIN },
+    { .fd = -1, .events = POLLIN }
+  };
+
+  for (;;)
+    {
+      fds[1].fd = jobout_fd ();
+      int n = poll (fds, 2, -1);
+      if (n == -1 && errno != EINTR)
+	break;
+      if (n > 0 && fds[1].revents)
+	jobout_drain ();
+      if (n > 0 && fds[0].revents)
+	break;
+    }
+}
+
+void
+jobout_finish ()
+{
+  while (captures)
+    {
+      struct pollfd fd = { .fd = epoll_fd, .events = POLLIN };
+      if (poll (&fd, 1, -1) == -1 && errno != EINTR)
+	break;
+      jobout_drain ();
+    }
+}
+
+void
+jobout_reset ()
+{
+  // The epoll instance is shared with the shell, so the pipes must
+  // only be closed here, not taken out of it.
+  if (epoll_fd != -1)
+    {
+      close (epoll_fd);
+      epoll_fd = -1;
+    }
+
+  while (captures)
+    {
+      capture *c = captures;
+      captures = c->next;
+      if (c->fd != -1)
+	close (c->fd);
+      free (c->buf);
+      free (c);
+    }
+  owner = NULL;
+}
@@ -0,0 +1,67 @@
+/* Copyright (C) 2021 by Alexandru-Sergiu Marton
+
+   This file is part of shell243.
+   
+   shell243 is free software: you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+   
+   shell243 is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+   
+   You should have received a copy of the GNU General Public License
+   along with shell243.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef SH243_JOBOUT_H
+#define SH243_JOBOUT_H
+
+#include <stdbool.h>
+
+// With set -o jobout, every background job writes its stdout and
+// stderr to a pipe of its own, and the shell copies what comes out of
+// those pipes to its stdout:
+//
+//   lines  each whole line, as soon as it's there, as "[jid] line"
+//   group  one job's output at a time, so it's never interleaved;
+//          jobs that are done go first
+//
+// The shell holds at most set -o jobbuf KiB per job. Once a job's
+// buffer is full its pipe isn't read until it's this job's turn, so the
+// job blocks on write instead of the shell growing without bound.
+
+// Makes the pipe for a job about to be forked, or returns false if
+// its output isn't to be collected.
+bool
+jobout_pipe (int fildes[2]);
+
+// Starts collecting from `fd', the read end of job `jid''s pipe.
+void
+jobout_add (int jid, int fd);
+
+// Becomes readable when there is job output to collect, or -1 if
+// there's nothing to collect from.
+int
+jobout_fd ();
+
+// Reads what the jobs have written so far, without blocking on them,
+// and prints what it can.
+void
+jobout_drain ();
+
+// Blocks until `fd' is readable, collecting job output meanwhile.
+void
+jobout_wait (int fd);
+
+// Collects the jobs' output until every job has closed its pipe.
+void
+jobout_finish ();
+
+// Forgets the other jobs' pipes in a forked child.
+void
+jobout_reset ();
+
+#endif
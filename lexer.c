@@ -41,14 +41,81 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <ctype.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include "lexer.h"
+#include "stats.h"
 
 stream stm;
 
 typedef enum { Q_SINGLE, Q_DOUBLE, Q_BACKSLASH, Q_NONE } quote_type;
 
+// Everything that isn't CC_WORD ends a run of plain word characters.
+enum { CC_WORD, CC_SPACE, CC_OPERATOR, CC_QUOTE, CC_END };
+
+static const unsigned char char_class[256] = {
+  ['\0'] = CC_END,
+  [' '] = CC_SPACE, ['\t'] = CC_SPACE, ['\n'] = CC_SPACE,
+  ['\v'] = CC_SPACE, ['\f'] = CC_SPACE, ['\r'] = CC_SPACE,
+  ['|'] = CC_OPERATOR, ['&'] = CC_OPERATOR, ['<'] = CC_OPERATOR,
+  ['>'] = CC_OPERATOR, [';'] = CC_OPERATOR,
+  ['\''] = CC_QUOTE, ['"'] = CC_QUOTE, ['\\'] = CC_QUOTE
+};
+
+#define CLASS_OF(c) (char_class[(unsigned char) (c)])
+
+#ifdef __SSE2__
+// Bit i of the result is set if byte i of `chunk' isn't CC_WORD.
+static unsigned
+special_mask (__m128i chunk)
+{
+  // \t \n \v \f \r are the range 9..13: x - 9 <= 4, unsigned.
+  __m128i shifted = _mm_sub_epi8 (chunk, _mm_set1_epi8 (9));
+  __m128i hits = _mm_cmpeq_epi8 (_mm_min_epu8 (shifted, _mm_set1_epi8 (4)),
+				 shifted);
+  static const char specials[] = { '\0', ' ', '|', '&', '<', '>', ';',
+				   '\'', '"', '\\' };
+  for (size_t i = 0; i < sizeof (specials); i++)
+    hits = _mm_or_si128 (hits, _mm_cmpeq_epi8 (chunk,
+						_mm_set1_epi8 (specials[i])));
+
+  return _mm_movemask_epi8 (hits);
+}
+
+// Returns the first character of `p' that isn't CC_WORD, 16 bytes at a
+// time. Loads are 16-byte aligned, so they may read past the
+// terminating '\0' but never into the next page.
+static char *
+scan_word (char *p)
+{
+  uintptr_t misalign = (uintptr_t) p & 15;
+  const __m128i *chunk = (const __m128i *) (p - misalign);
+  unsigned mask = special_mask (_mm_load_si128 (chunk)) >> misalign;
+  if (mask)
+    return p + __builtin_ctz (mask);
+
+  for (;;)
+    {
+      chunk++;
+      mask = special_mask (_mm_load_si128 (chunk));
+      if (mask)
+	return (char *) chunk + __builtin_ctz (mask);
+    }
+}
+#else
+static char *
+scan_word (char *p)
+{
+  while (CLASS_OF (*p) == CC_WORD)
+    p++;
+  return p;
+}
+#endif
+
 static token
 make_token (token_type type)
 {
@@ -91,82 +158,110 @@ peek ()
   return *stm.current;
 }
 
+// Quotes and backslashes are removed in a single pass: the unquoted
+// bytes are copied down to `out', which never gets ahead of the read
+// position, so the word ends up contiguous at stm.start.
 static token
-word (quote_type qtype)
+word ()
 {
-  int quote_offset = 0;
+  quote_type qtype = Q_NONE;
   bool can_be_ionum = true;
-  char c = peek ();
-  while (!is_at_end ())
-    {
-      if (qtype == Q_NONE
-	  && (c == '|' || c == '&' || c == '<' || c == '>' || c == ';'
-	      || isspace (c)))
-	break;
+  char *out = stm.start;
 
-      if (c == '\\' && qtype == Q_NONE)
-	qtype = Q_BACKSLASH, quote_offset = stm.current - stm.start;
-      else if (c == '\'' && qtype == Q_NONE)
-	qtype = Q_SINGLE, quote_offset = stm.current - stm.start;
-      else if (c == '"' && qtype == Q_NONE)
-	qtype = Q_DOUBLE, quote_offset = stm.current - stm.start;
-      else if (qtype == Q_BACKSLASH)
+  stm.current = stm.start;
+  for (;;)
+    {
+      if (qtype == Q_NONE)
 	{
-	  qtype = Q_NONE;
-	  memmove (stm.current - 1, stm.current, strlen (stm.current) + 1);
-	  --stm.current;
+	  // Consume the whole run of unquoted word characters at once.
+	  char *end = scan_word (stm.current);
+	  size_t n = end - stm.current;
+	  if (can_be_ionum)
+	    for (size_t i = 0; i < n && can_be_ionum; i++)
+	      can_be_ionum = isdigit ((unsigned char) stm.current[i]);
+	  if (out != stm.current)
+	    memmove (out, stm.current, n);
+	  out += n;
+	  stm.current = end;
+
+	  if (CLASS_OF (peek ()) != CC_QUOTE)
+	    break;
 	}
-      else if ((c == '\'' && qtype == Q_SINGLE)
-	       || (c == '"' && qtype == Q_DOUBLE))
+      else if (is_at_end ())
+	break;
+
+      // Whatever comes next is a quote or is quoted.
+      can_be_ionum = false;
+      char c = advance ();
+      switch (qtype)
 	{
+	case Q_NONE:
+	  if (c == '\\')
+	    qtype = Q_BACKSLASH;
+	  else if (c == '\'')
+	    qtype = Q_SINGLE;
+	  else
+	    qtype = Q_DOUBLE;
+	  break;
+	case Q_BACKSLASH:
 	  qtype = Q_NONE;
-	  // Since this means we found both opening and closing
-	  // quotes, we can safely shift our input two chars leftward.
-	  memmove (stm.start + quote_offset, stm.start + quote_offset + 1,
-		   strlen (stm.start + quote_offset + 1) + 1);
-	  --stm.current;
-	  memmove (stm.current, stm.current + 1,
-		   strlen (stm.current + 1) + 1);
-	  --stm.current;
+	  *out++ = c;
+	  break;
+	case Q_SINGLE:
+	case Q_DOUBLE:
+	  if (c == (qtype == Q_SINGLE ? '\'' : '"'))
+	    qtype = Q_NONE;
+	  else
+	    *out++ = c;
+	  break;
 	}
-
-      if (can_be_ionum && !isdigit (c))
-	can_be_ionum = false;
-
-      advance ();
-      c = peek ();
     }
 
-  if (qtype != Q_NONE && is_at_end ())
+  if (qtype != Q_NONE)
     return error_token ("Reached EOF before closing quote.");
 
-  if (can_be_ionum && (c == '<' || c == '>'))
-    return make_token (TOK_IONUM);
+  token tok = make_token (TOK_WORD);
+  tok.length = out - stm.start;
+  if (can_be_ionum && (peek () == '<' || peek () == '>'))
+    tok.type = TOK_IONUM;
 
-  return make_token (TOK_WORD);
+  // If quotes were removed there's a free byte to terminate the word
+  // right away; otherwise it has to wait until the delimiter is read.
+  if (out < stm.current || is_at_end ())
+    *out = '\0';
+  else
+    stm.terminate = out;
+
+  return tok;
 }
 
 static void
 skip_whitespace ()
 {
-  while (!is_at_end () && isspace (peek ()))
+  while (CLASS_OF (peek ()) == CC_SPACE)
     advance ();
 }
 
 void
 init_lexer (char *cmd)
 {
-  stm = (stream) { .start = cmd, .current = cmd };
+  stm = (stream) { .start = cmd, .current = cmd, .terminate = NULL };
 }
 
 token
 next_token ()
 {
+  stat_count (STAT_TOKENS);
   stm.start = stm.current;
   if (is_at_end ())
     return make_token (TOK_EOF);
 
   char c = advance ();
+  if (stm.terminate)
+    {
+      *stm.terminate = '\0';
+      stm.terminate = NULL;
+    }
 
   switch (c)
     {
@@ -188,19 +283,13 @@ next_token ()
       if (match ('>'))
 	return make_token (TOK_DGT);
       return make_token (TOK_GT);
-    case '\'':
-      return word (Q_SINGLE);
-    case '"':
-      return word (Q_DOUBLE);
-    case '\\':
-      return word (Q_BACKSLASH);
     default:
-      if (isspace (c))
+      if (CLASS_OF (c) == CC_SPACE)
 	{
 	  skip_whitespace ();
 	  return next_token ();
 	}
-      return word (Q_NONE);
+      return word ();
     }
 
   return error_token ("Unexpected character.");
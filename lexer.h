@@ -35,6 +35,9 @@ typedef struct stream
 {
   char *start;
   char *current;
+  // End of the last word, overwritten with '\0' as soon as the lexer
+  // has read the delimiter that was there.
+  char *terminate;
 } stream;
 extern stream stm;
 
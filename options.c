@@ -0,0 +1,162 @@
+/* Copyright (C) 2021 by Alexandru-Sergiu Marton
+
+   This file is part of shell243.
+   
+   shell243 is free software: you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+   
+   shell243 is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+   
+   You should have received a copy of the GNU General Public License
+   along with shell243.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "options.h"
+
+shell_options options = {
+  .maxjobs = 0,
+  .astcache = 1024,
+  .pipefail = false,
+  .failfast = false,
+  .jobout = JOBOUT_OFF,
+  .jobbuf = 64
+};
+
+typedef enum { OPT_BOOL, OPT_COUNT, OPT_CHOICE } option_type;
+
+typedef struct option
+{
+  const char *name;
+  option_type type;
+  void *value;
+  // The names of the values of an OPT_CHOICE, the first meaning off.
+  const char *const *choices;
+} option;
+
+static const char *const jobout_choices[] = { "off", "lines", "group", NULL };
+
+static const option option_table[] = {
+  { "maxjobs", OPT_COUNT, &options.maxjobs, NULL },
+  { "astcache", OPT_COUNT, &options.astcache, NULL },
+  { "pipefail", OPT_BOOL, &options.pipefail, NULL },
+  { "failfast", OPT_BOOL, &options.failfast, NULL },
+  { "jobout", OPT_CHOICE, &options.jobout, jobout_choices },
+  { "jobbuf", OPT_COUNT, &options.jobbuf, NULL },
+};
+
+#define NOPTIONS (sizeof (option_table) / sizeof (option_table[0]))
+
+static const option *
+find_option (const char *name, size_t len)
+{
+  for (size_t i = 0; i < NOPTIONS; i++)
+    if (strlen (option_table[i].name) == len
+	&& strncmp (option_table[i].name, name, len) == 0)
+      return &option_table[i];
+
+  fprintf (stderr, "set: %.*s: invalid option name\n", (int) len, name);
+  return NULL;
+}
+
+static void
+print_options ()
+{
+  for (size_t i = 0; i < NOPTIONS; i++)
+    {
+      const option *opt = &option_table[i];
+      if (opt->type == OPT_BOOL)
+	printf ("%-15s %s\n", opt->name, *(bool *) opt->value ? "on" : "off");
+      else if (opt->type == OPT_CHOICE)
+	printf ("%-15s %s\n", opt->name, opt->choices[*(int *) opt->value]);
+      else
+	printf ("%-15s %d\n", opt->name, *(int *) opt->value);
+    }
+}
+
+static bool
+set_option (const char *arg, bool on)
+{
+  const char *eq = strchr (arg, '=');
+  const option *opt = find_option (arg, eq ? (size_t) (eq - arg)
+				   : strlen (arg));
+  if (!opt)
+    return false;
+
+  if (opt->type == OPT_BOOL)
+    {
+      if (eq)
+	{
+	  fprintf (stderr, "set: %s: takes no value\n", opt->name);
+	  return false;
+	}
+      *(bool *) opt->value = on;
+      return true;
+    }
+
+  if (!on || !eq)
+    {
+      if (on)
+	{
+	  fprintf (stderr, "set: %s: value expected\n", opt->name);
+	  return false;
+	}
+      *(int *) opt->value = 0;
+      return true;
+    }
+
+  if (opt->type == OPT_CHOICE)
+    {
+      for (int i = 0; opt->choices[i]; i++)
+	if (strcmp (opt->choices[i], eq + 1) == 0)
+	  {
+	    *(int *) opt->value = i;
+	    return true;
+	  }
+      fprintf (stderr, "set: %s: invalid value\n", eq + 1);
+      return false;
+    }
+
+  char *endptr;
+  long value = strtol (eq + 1, &endptr, 10);
+  if (eq[1] == '\0' || *endptr != '\0' || value < 0 || value > 1 << 30)
+    {
+      fprintf (stderr, "set: %s: invalid value\n", eq + 1);
+      return false;
+    }
+  *(int *) opt->value = value;
+  return true;
+}
+
+int
+builtin_set (int argc, char **argv)
+{
+  if (argc == 1 || (argc == 2 && strcmp (argv[1], "-o") == 0))
+    {
+      print_options ();
+      return EXIT_SUCCESS;
+    }
+
+  for (int i = 1; i < argc; i++)
+    {
+      bool on = strcmp (argv[i], "-o") == 0;
+      if ((!on && strcmp (argv[i], "+o") != 0) || i + 1 == argc)
+	{
+	  fputs ("set: usage: set [-o name[=value]] [+o name]\n", stderr);
+	  return 2;
+	}
+      if (!set_option (argv[++i], on))
+	return EXIT_FAILURE;
+    }
+
+  return EXIT_SUCCESS;
+}
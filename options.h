@@ -0,0 +1,54 @@
+/* Copyright (C) 2021 by Alexandru-Sergiu Marton
+
+   This file is part of shell243.
+   
+   shell243 is free software: you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+   
+   shell243 is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+   
+   You should have received a copy of the GNU General Public License
+   along with shell243.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef SH243_OPTIONS_H
+#define SH243_OPTIONS_H
+
+#include <stdbool.h>
+
+// Where the output of background jobs goes: straight to the terminal,
+// or through the shell a line at a time or a job at a time.
+typedef enum jobout_mode
+  {
+    JOBOUT_OFF,
+    JOBOUT_LINES,
+    JOBOUT_GROUP
+  } jobout_mode;
+
+// Shell-wide settings, changed with the set builtin.
+typedef struct shell_options
+{
+  int maxjobs; // background jobs running at once, 0 for no limit
+  int astcache; // KiB of parsed lines to keep, 0 to disable the cache
+  bool pipefail; // a pipe sequence fails if any stage does
+  bool failfast; // stop the other stages once one fails
+  jobout_mode jobout; // how background jobs' output is collected
+  int jobbuf; // KiB of output the shell holds per background job
+} shell_options;
+
+extern shell_options options;
+
+// set -o                 lists the options
+// set -o name[=value]    turns an option on, or gives it a value
+// set -o jobout=lines    prefixes each line of a job's output with its id
+// set -o jobout=group    prints each job's output in one piece
+// set +o name            turns it off
+int
+builtin_set (int argc, char **argv);
+
+#endif
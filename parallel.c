@@ -0,0 +1,384 @@
+/* Copyright (C) 2021 by Alexandru-Sergiu Marton
+
+   This file is part of shell243.
+   
+   shell243 is free software: you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+   
+   shell243 is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+   
+   You should have received a copy of the GNU General Public License
+   along with shell243.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <sys/epoll.h>
+#include <poll.h>
+
+#include "parallel.h"
+#include "spawner.h"
+#include "cmdhash.h"
+#include "reaper.h"
+#include "fds.h"
+#include "jobout.h"
+#include "job.h"
+
+typedef struct task
+{
+  pid_t pid;
+  int pidfd; // -1 without one
+  job *job;
+  int index; // of the item, in item_statuses
+  char *item;
+} task;
+
+// The exit status of every item of the last parallel, in item order.
+static int *item_statuses = NULL;
+static int nitems = 0, items_cap = 0;
+
+const int *
+last_parstatus (int *len)
+{
+  *len = nitems;
+  return item_statuses;
+}
+
+int
+builtin_parstatus (int argc, char **argv)
+{
+  (void) argc, (void) argv;
+  for (int i = 0; i < nitems; i++)
+    printf (i ? " %d" : "%d", item_statuses[i]);
+  putchar ('\n');
+
+  return EXIT_SUCCESS;
+}
+
+static int
+add_item_status ()
+{
+  if (nitems == items_cap)
+    {
+      items_cap = items_cap ? items_cap * 2 : 64;
+      item_statuses = (int *) realloc (item_statuses,
+				       sizeof (int) * items_cap);
+    }
+  item_statuses[nitems] = 0;
+  return nitems++;
+}
+
+// The running tasks are waited for through their pidfds, in an epoll
+// set, and reaped by pid: parallel may be the last stage of a pipe
+// sequence whose other stages are pipe_wait's. Tasks that get no pidfd
+// are checked by pid whenever SIGCHLD comes.
+typedef struct task_set
+{
+  task *tasks;
+  long nslots;
+  int epfd;
+  long nopidfd; // running tasks without a pidfd
+} task_set;
+
+typedef struct item_source
+{
+  char **items; // from the command line, or NULL to read `in'
+  int nitems, next;
+  FILE *in;
+  char *line;
+  size_t line_cap;
+} item_source;
+
+static const char *
+next_item (item_source *src)
+{
+  if (src->items)
+    return src->next < src->nitems ? src->items[src->next++] : NULL;
+
+  ssize_t n = getline (&src->line, &src->line_cap, src->in);
+  if (n == -1)
+    return NULL;
+  if (n > 0 && src->line[n - 1] == '\n')
+    src->line[n - 1] = '\0';
+  return src->line;
+}
+
+// Replaces every "{}" in `arg' with `item'.
+static char *
+substitute (const char *arg, const char *item)
+{
+  size_t item_len = strlen (item), len = 0;
+  for (const char *p = arg; *p; p++)
+    len += (p[0] == '{' && p[1] == '}') ? (p++, item_len) : 1;
+
+  char *result = (char *) malloc (len + 1), *out = result;
+  for (const char *p = arg; *p; p++)
+    if (p[0] == '{' && p[1] == '}')
+      {
+	memcpy (out, item, item_len);
+	out += item_len;
+	p++;
+      }
+    else
+      *out++ = *p;
+  *out = '\0';
+
+  return result;
+}
+
+static pid_t
+start_task (char **template, int ntemplate, bool has_placeholder,
+	    const char *item, const redir_action *redirs, int nredirs)
+{
+  char **argv = (char **) malloc (sizeof (char *) * (ntemplate + 2));
+  int argc = 0;
+  for (int i = 0; i < ntemplate; i++)
+    argv[argc++] = has_placeholder ? substitute (template[i], item)
+      : template[i];
+  if (!has_placeholder)
+    argv[argc++] = (char *) item;
+  argv[argc] = NULL;
+
+  pid_t pid = spawn_process (cmdhash_lookup (argv[0]), argv, STDIN_FILENO,
+			     STDOUT_FILENO, redirs, nredirs);
+  int saved_errno = errno;
+  if (pid == -1)
+    fprintf (stderr, "parallel: %s: %s\n", argv[0], strerror (errno));
+
+  if (has_placeholder)
+    for (int i = 0; i < ntemplate; i++)
+      free (argv[i]);
+  free (argv);
+
+  errno = saved_errno;
+  return pid;
+}
+
+static void
+watch_task (task_set *ts, long s)
+{
+  task *t = &ts->tasks[s];
+  t->pidfd = ts->epfd == -1 ? -1 : fd_pidfd (t->pid);
+  struct epoll_event ev = { .events = EPOLLIN, .data.u64 = s };
+  if (t->pidfd != -1 && epoll_ctl (ts->epfd, EPOLL_CTL_ADD, t->pidfd, &ev))
+    {
+      close (t->pidfd);
+      t->pidfd = -1;
+    }
+  if (t->pidfd == -1)
+    ts->nopidfd++;
+}
+
+static void
+unwatch_task (task_set *ts, long s)
+{
+  task *t = &ts->tasks[s];
+  if (t->pidfd == -1)
+    ts->nopidfd--;
+  else
+    {
+      epoll_ctl (ts->epfd, EPOLL_CTL_DEL, t->pidfd, NULL);
+      close (t->pidfd);
+    }
+}
+
+static bool
+reap_task (task_set *ts, long s, int flags, int *wstatus)
+{
+  pid_t pid;
+  while ((pid = waitpid (ts->tasks[s].pid, wstatus, flags)) == -1
+	 && errno == EINTR)
+    ;
+  return pid > 0;
+}
+
+// Waits for a task to exit. Returns its slot, with its wait status in
+// *wstatus, or -1 on error.
+static long
+wait_task (task_set *ts, int *wstatus)
+{
+  for (;;)
+    {
+      if (ts->nopidfd)
+	{
+	  reaper_clear ();
+	  for (long s = 0; s < ts->nslots; s++)
+	    if (ts->tasks[s].pid && ts->tasks[s].pidfd == -1
+		&& reap_task (ts, s, reaper_fd () == -1 ? 0 : WNOHANG,
+			      wstatus))
+	      return s;
+	}
+
+      struct pollfd fds[3] = {
+	{ .fd = ts->epfd, .events = POLLIN },
+	{ .fd = jobout_fd (), .events = POLLIN },
+	{ .fd = ts->nopidfd ? reaper_fd () : -1, .events = POLLIN }
+      };
+      if (poll (fds, 3, -1) == -1)
+	{
+	  if (errno == EINTR)
+	    continue;
+	  return -1;
+	}
+      if (fds[1].revents)
+	jobout_drain ();
+
+      struct epoll_event ev;
+      if (fds[0].revents && epoll_wait (ts->epfd, &ev, 1, 0) == 1
+	  && reap_task (ts, ev.data.u64, 0, wstatus))
+	return ev.data.u64;
+    }
+}
+
+int
+builtin_parallel (int argc, char **argv)
+{
+  long nslots = sysconf (_SC_NPROCESSORS_ONLN);
+  int i = 1;
+
+  if (i + 1 < argc && strcmp (argv[i], "-j") == 0)
+    {
+      char *endptr;
+      nslots = strtol (argv[i + 1], &endptr, 10);
+      if (*endptr != '\0' || nslots < 1)
+	{
+	  fprintf (stderr, "parallel: %s: invalid job count\n", argv[i + 1]);
+	  return 2;
+	}
+      i += 2;
+    }
+  if (nslots < 1)
+    nslots = 1;
+
+  char **template = argv + i;
+  int ntemplate = 0;
+  while (i + ntemplate < argc && strcmp (template[ntemplate], ":::") != 0)
+    ntemplate++;
+  if (ntemplate == 0)
+    {
+      fputs ("parallel: usage: parallel [-j N] command [arg...]"
+	     " [::: item...]\n", stderr);
+      return 2;
+    }
+
+  item_source src = { .items = NULL };
+  // Commands don't get to read the items meant for parallel itself.
+  redir_action null_stdin = { REDIR_IN, STDIN_FILENO, O_RDONLY, "/dev/null" };
+  int nredirs = 1;
+  if (i + ntemplate < argc)
+    {
+      src.items = template + ntemplate + 1;
+      src.nitems = argc - (i + ntemplate + 1);
+      nredirs = 0;
+    }
+  // The shell may itself be reading a script from the stdin stream, so
+  // read the items through a separate one.
+  else if (!(src.in = fdopen (fd_dup (STDIN_FILENO), "r")))
+    {
+      perror ("parallel");
+      return EXIT_FAILURE;
+    }
+
+  bool has_placeholder = false;
+  for (int k = 0; k < ntemplate; k++)
+    if (strstr (template[k], "{}"))
+      has_placeholder = true;
+
+  task *tasks = (task *) calloc (nslots, sizeof (task));
+  task_set ts = { tasks, nslots, epoll_create1 (EPOLL_CLOEXEC), 0 };
+  int running = 0, failed = 0;
+  nitems = 0;
+  bool interrupted = false;
+  const char *item;
+
+  fflush (stdout);
+  for (;;)
+    {
+      // Fill every free slot, then wait for one to free up.
+      for (long s = 0; s < nslots && !interrupted; s++)
+	{
+	  if (tasks[s].pid)
+	    continue;
+	  if (!(item = next_item (&src)))
+	    break;
+
+	  int index = add_item_status ();
+	  pid_t pid = start_task (template, ntemplate, has_placeholder, item,
+				  &null_stdin, nredirs);
+	  if (pid == SPAWN_BAD_REDIRECT)
+	    {
+	      item_statuses[index] = EXIT_FAILURE;
+	      failed++;
+	    }
+	  else if (pid == -1)
+	    {
+	      item_statuses[index] = errno == ENOENT ? 127 : 126;
+	      failed++;
+	    }
+	  else
+	    {
+	      tasks[s].pid = pid;
+	      tasks[s].job = job_add (pid);
+	      tasks[s].index = index;
+	      tasks[s].item = strdup (item);
+	      watch_task (&ts, s);
+	      running++;
+	    }
+	}
+
+      if (running == 0)
+	break;
+
+      int wstatus;
+      long s = wait_task (&ts, &wstatus);
+      if (s == -1)
+	{
+	  perror ("parallel: poll");
+	  break;
+	}
+      unwatch_task (&ts, s);
+
+      if (WIFSIGNALED (wstatus) && WTERMSIG (wstatus) == SIGINT)
+	interrupted = true;
+      int status = WIFEXITED (wstatus) ? WEXITSTATUS (wstatus)
+	: 128 + WTERMSIG (wstatus);
+      item_statuses[tasks[s].index] = status;
+      if (status != 0)
+	{
+	  fprintf (stderr, "parallel: %s: exit status %d\n", tasks[s].item,
+		   status);
+	  failed++;
+	}
+
+      // Tasks are jobs only while they run: they are never reported.
+      job_update (tasks[s].job, wstatus);
+      job_remove (tasks[s].job);
+      free (tasks[s].item);
+      tasks[s].pid = 0;
+      running--;
+    }
+
+  if (ts.epfd != -1)
+    close (ts.epfd);
+  free (tasks);
+  free (src.line);
+  if (src.in)
+    fclose (src.in);
+
+  // Like GNU parallel: the number of failed items, up to 100.
+  return failed > 100 ? 101 : failed;
+}
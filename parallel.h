@@ -0,0 +1,41 @@
+/* Copyright (C) 2021 by Alexandru-Sergiu Marton
+
+   This file is part of shell243.
+   
+   shell243 is free software: you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+   
+   shell243 is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+   
+   You should have received a copy of the GNU General Public License
+   along with shell243.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef SH243_PARALLEL_H
+#define SH243_PARALLEL_H
+
+// parallel [-j N] command [arg...] [::: item...]
+//
+// Runs command once per item, at most N at a time (the number of
+// online CPUs by default). "{}" in the arguments is replaced by the
+// item; without one, the item is appended. Without ":::", items are
+// read from stdin, one per line.
+//
+// The tasks are in the job table while they run. Returns the number of
+// items that failed, up to 101; parstatus prints every item's status.
+int
+builtin_parallel (int argc, char **argv);
+
+// The exit status of each item of the last parallel, in item order.
+const int *
+last_parstatus (int *len);
+
+int
+builtin_parstatus (int argc, char **argv);
+
+#endif
@@ -24,24 +24,31 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 #include "parser.h"
 #include "lexer.h"
 #include "debug.h"
+#include "arena.h"
 
 static token current_token;
 
+// Every node, children array and string of the tree returned by parse
+// lives here until parser_reset.
+static arena ast_arena;
+
 #define MATCH(ttype) (current_token.type == ttype)
 
 static ast_node *
 make_error (const char *message)
 {
-  ast_node *node = (ast_node *) malloc (sizeof (ast_node));
+  ast_node *node = (ast_node *) arena_alloc (&ast_arena, sizeof (ast_node));
   node->type = AST_ERROR;
   node->len = 0;
+  node->cap = 0;
   node->children = NULL;
-  node->string = (char *) malloc (strlen (message) + 1);
-  strcpy (node->string, message);
+  node->string = arena_strndup (&ast_arena, message, strlen (message));
 
   return node;
 }
@@ -49,7 +56,7 @@ make_error (const char *message)
 static ast_node *
 empty_node (ast_node_type type)
 {
-  ast_node *node = (ast_node *) malloc (sizeof (ast_node));
+  ast_node *node = (ast_node *) arena_alloc (&ast_arena, sizeof (ast_node));
   node->cap = 0;
   node->len = 0;
   node->children = NULL;
@@ -63,15 +70,16 @@ static ast_node *
 from_token (token tok, ast_node_type type)
 {
   ast_node *node = empty_node (type);
-  node->string = (char *) malloc (tok.length + 1);
-  strncpy (node->string, tok.start, tok.length);
-  node->string[tok.length] = '\0';
   if (type == AST_NUMBER)
+    node->number = atoi (tok.start); // stops at the redirect operator
+  else if (type == AST_REDIR_OP)
+    node->op = tok.type;
+  else
     {
-      int number = atoi (node->string);
-      free (node->string);
-      node->string = NULL;
-      node->number = number;
+      // The lexer NUL-terminates the word in place once it has moved
+      // past it.
+      node->string = (char *) tok.start;
+      node->length = tok.length;
     }
 
   return node;
@@ -80,36 +88,24 @@ from_token (token tok, ast_node_type type)
 static void
 add_child (ast_node *node, ast_node *child)
 {
-  node->len++;
-  if (node->len > node->cap)
+  if (node->len == node->cap)
     {
-      if (node->cap == 0)
-	node->cap = 2;
-      else
-	node->cap *= 2;
-
-      ast_node **new_kids =
-	(ast_node **) malloc (sizeof (ast_node *) * node->cap);
-      for (int i = 0; i < node->len - 1; i++)
-	new_kids[i] = node->children[i];
-      free (node->children);
-      node->children = new_kids;
+      int cap = node->cap ? node->cap * 2 : 2;
+      // Doubling keeps the copying linear overall, and there is none
+      // when nothing was allocated after the array.
+      node->children =
+	(ast_node **) arena_realloc (&ast_arena, node->children,
+				     sizeof (ast_node *) * node->cap,
+				     sizeof (ast_node *) * cap);
+      node->cap = cap;
     }
-  node->children[node->len - 1] = child;
+  node->children[node->len++] = child;
 }
 
 void
-ast_free (ast_node *node)
+parser_reset ()
 {
-  if (node->string != NULL)
-    free (node->string);
-  if (node->cap > 0)
-    {
-      for (int i = 0; i < node->len; i++)
-	ast_free (node->children[i]);
-      free (node->children);
-    }
-  free (node);
+  arena_reset (&ast_arena);
 }
 
 static ast_node *
@@ -155,6 +151,52 @@ parse_redirect ()
   return redirect_node;
 }
 
+command_plan *
+make_plan (arena *a, const ast_node *cmd)
+{
+  command_plan *plan = (command_plan *) arena_alloc (a, sizeof (command_plan));
+  plan->argv = (char **) arena_alloc (a, sizeof (char *) * (cmd->len + 1));
+  plan->redirs = (redir_action *) arena_alloc (a, sizeof (redir_action)
+					       * cmd->len);
+  plan->argc = plan->nredirs = 0;
+
+  for (int i = 0; i < cmd->len; i++)
+    {
+      const ast_node *node = cmd->children[i];
+      if (node->type == AST_WORD)
+	plan->argv[plan->argc++] = node->string;
+      else if (node->type == AST_REDIRECT)
+	{
+	  redir_action *r = &plan->redirs[plan->nredirs++];
+	  const ast_node *op = node->children[node->len - 2];
+	  r->path = node->children[node->len - 1]->string;
+	  switch (op->op)
+	    {
+	    case TOK_LT:
+	      r->kind = REDIR_IN;
+	      r->fd = STDIN_FILENO;
+	      r->flags = O_RDONLY;
+	      break;
+	    case TOK_DGT:
+	      r->kind = REDIR_APPEND;
+	      r->fd = STDOUT_FILENO;
+	      r->flags = O_WRONLY | O_CREAT | O_APPEND;
+	      break;
+	    default:
+	      r->kind = REDIR_OUT;
+	      r->fd = STDOUT_FILENO;
+	      r->flags = O_WRONLY | O_CREAT | O_TRUNC;
+	      break;
+	    }
+	  if (node->len == 3) // IONUM
+	    r->fd = node->children[0]->number;
+	}
+    }
+  plan->argv[plan->argc] = NULL;
+
+  return plan;
+}
+
 static ast_node *
 parse_command ()
 {
@@ -183,6 +225,8 @@ parse_command ()
       current_token = next_token ();
     }
 
+  command_node->plan = make_plan (&ast_arena, command_node);
+
   return command_node;
 }
 
@@ -202,41 +246,37 @@ parse_pipe_seq ()
   return pipe_seq_node;
 }
 
-static ast_node *
-parse_and_or_nested (ast_node *left)
+static bool
+match_time ()
 {
-  ast_node *and_or_node = empty_node (MATCH (TOK_AND) ? AST_AND : AST_OR);
-  current_token = next_token ();
-  ast_node *pipe_seq_node = parse_pipe_seq ();
-
-  add_child (and_or_node, left);
-  add_child (and_or_node, pipe_seq_node);
-
-  if (MATCH (TOK_AND) || MATCH (TOK_OR))
-    return parse_and_or_nested (and_or_node);
-  else
-    return and_or_node;
+  return MATCH (TOK_WORD) && current_token.length == 4
+    && strncmp (current_token.start, "time", 4) == 0;
 }
 
+// and or = pipe sequence, { ( AND | OR ), pipe sequence } ;
+// built left-associatively: a && b || c is ((a && b) || c).
 static ast_node *
 parse_and_or ()
 {
-  ast_node *pipe_seq_node = parse_pipe_seq ();
-
-  if (!MATCH (TOK_AND) && !MATCH (TOK_OR))
-    return pipe_seq_node;
-
-  ast_node *and_or_node = empty_node (MATCH (TOK_AND) ? AST_AND : AST_OR);
-  add_child (and_or_node, pipe_seq_node);
-  current_token = next_token ();
+  if (match_time ())
+    {
+      current_token = next_token ();
+      ast_node *time_node = empty_node (AST_TIME);
+      add_child (time_node, parse_and_or ());
+      return time_node;
+    }
 
-  pipe_seq_node = parse_pipe_seq ();
-  add_child (and_or_node, pipe_seq_node);
+  ast_node *left = parse_pipe_seq ();
+  while (MATCH (TOK_AND) || MATCH (TOK_OR))
+    {
+      ast_node *and_or_node = empty_node (MATCH (TOK_AND) ? AST_AND : AST_OR);
+      current_token = next_token ();
+      add_child (and_or_node, left);
+      add_child (and_or_node, parse_pipe_seq ());
+      left = and_or_node;
+    }
 
-  if (MATCH (TOK_AND) || MATCH (TOK_OR))
-    return parse_and_or_nested (and_or_node);
-  else
-    return and_or_node;
+  return left;
 }
 
 ast_node *
@@ -264,7 +304,6 @@ parse ()
     {
       print_token (current_token);
       print_ast (program_node, 0);
-      ast_free (program_node);
       char err[64];
       sprintf (err, "Expected TOK_EOF, got %s.",
 	       token_type_to_string (current_token.type));
@@ -274,21 +313,105 @@ parse ()
   return program_node;
 }
 
-bool
-check_ast_error (ast_node *ast)
+static ast_node *
+copy_node (arena *a, const ast_node *node)
 {
-  if (ast->type == AST_ERROR)
+  ast_node *copy = (ast_node *) arena_alloc (a, sizeof (ast_node));
+  *copy = *node;
+
+  if (node->len > 0)
     {
-      fprintf (stdout, "%s\n", ast->string);
-      return true;
+      copy->cap = node->len;
+      copy->children =
+	(ast_node **) arena_alloc (a, sizeof (ast_node *) * node->len);
     }
-  else
+  if (node->type == AST_WORD || node->type == AST_ERROR)
+    copy->string = arena_strndup (a, node->string, strlen (node->string));
+
+  return copy;
+}
+
+// Trees are walked with an explicit stack: an and-or chain is as deep
+// as it is long.
+typedef struct walk_frame
+{
+  const ast_node *node;
+  ast_node *copy;
+  int next;
+} walk_frame;
+
+static walk_frame *
+push_frame (walk_frame *stack, int *depth, int *cap, walk_frame f)
+{
+  if (*depth == *cap)
     {
-      bool found = false;
-      for (int i = 0; i < ast->len; ++i)
-	found = found || check_ast_error (ast->children[i]);
-      return found;
+      *cap = *cap ? *cap * 2 : 64;
+      stack = (walk_frame *) realloc (stack, sizeof (walk_frame) * *cap);
     }
+  stack[(*depth)++] = f;
+  return stack;
+}
+
+ast_node *
+ast_clone (arena *a, const ast_node *node)
+{
+  walk_frame *stack = NULL;
+  int depth = 0, cap = 0;
+  ast_node *root = copy_node (a, node);
+
+  stack = push_frame (stack, &depth, &cap, (walk_frame) { node, root, 0 });
+  while (depth > 0)
+    {
+      walk_frame *f = &stack[depth - 1];
+      if (f->next < f->node->len)
+	{
+	  const ast_node *child = f->node->children[f->next];
+	  ast_node *copy = copy_node (a, child);
+	  f->copy->children[f->next++] = copy;
+	  stack = push_frame (stack, &depth, &cap,
+			      (walk_frame) { child, copy, 0 });
+	  continue;
+	}
+
+      // A plan points at the copies of its words, so it's built last.
+      if (f->node->type == AST_COMMAND)
+	f->copy->plan = make_plan (a, f->copy);
+      depth--;
+    }
+
+  free (stack);
+  return root;
+}
+
+bool
+check_ast_error (ast_node *ast)
+{
+  // Pre-order, so the error reported is the first one in the line.
+  walk_frame *stack = NULL;
+  int depth = 0, cap = 0;
+  bool found = false;
+
+  stack = push_frame (stack, &depth, &cap, (walk_frame) { ast, NULL, 0 });
+  while (depth > 0 && !found)
+    {
+      walk_frame *f = &stack[depth - 1];
+      if (f->next == 0 && f->node->type == AST_ERROR)
+	{
+	  fprintf (stdout, "%s\n", f->node->string);
+	  found = true;
+	}
+      else if (f->next < f->node->len)
+	{
+	  const ast_node *child = f->node->children[f->next++];
+	  stack = push_frame (stack, &depth, &cap,
+			      (walk_frame) { child, NULL, 0 });
+	}
+      else
+	depth--;
+    }
+
+  free (stack);
+  return found;
 }
 
 #undef MATCH
@@ -21,6 +21,10 @@
 
 #include <stdbool.h>
 
+#include "lexer.h"
+#include "plan.h"
+#include "arena.h"
+
 typedef enum ast_node_type
   {
     AST_PROGRAM,
@@ -29,6 +33,7 @@ typedef enum ast_node_type
     AST_AND,
     AST_OR,
     AST_PIPE_SEQ,
+    AST_TIME,
     AST_COMMAND,
     AST_REDIRECT,
     AST_REDIR_OP,
@@ -37,10 +42,18 @@ typedef enum ast_node_type
     AST_ERROR
   } ast_node_type;
 
+// AST_WORD strings aren't copied: they point into the line given to
+// init_lexer, which must outlive the tree.
 typedef struct ast_node
 {
   ast_node_type type;
-  union { char *string; int number; };
+  union
+  {
+    struct { char *string; int length; };
+    int number;
+    token_type op; // AST_REDIR_OP
+    command_plan *plan; // AST_COMMAND
+  };
   int len, cap;
   struct ast_node **children;
 } ast_node;
@@ -48,8 +61,17 @@ typedef struct ast_node
 ast_node *
 parse ();
 
+// Frees every tree returned by parse so far.
 void
-ast_free (ast_node *node);
+parser_reset ();
+
+// Deep-copies `node' into `a', so that it survives parser_reset.
+ast_node *
+ast_clone (arena *a, const ast_node *node);
+
+// Builds, in `a', the plan of an AST_COMMAND whose children are set.
+command_plan *
+make_plan (arena *a, const ast_node *cmd);
 
 bool
 check_ast_error (ast_node *node);
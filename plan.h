@@ -0,0 +1,49 @@
+/* Copyright (C) 2021 by Alexandru-Sergiu Marton
+
+   This file is part of shell243.
+   
+   shell243 is free software: you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+   
+   shell243 is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+   
+   You should have received a copy of the GNU General Public License
+   along with shell243.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef SH243_PLAN_H
+#define SH243_PLAN_H
+
+// What it takes to run a simple command, worked out by the parser so
+// that launching it doesn't have to look at the AST again.
+
+typedef enum redir_kind
+  {
+    REDIR_IN,     // <
+    REDIR_OUT,    // >
+    REDIR_APPEND  // >>
+  } redir_kind;
+
+// Open `path' with `flags' onto `fd'.
+typedef struct redir_action
+{
+  redir_kind kind;
+  int fd;
+  int flags;
+  const char *path;
+} redir_action;
+
+typedef struct command_plan
+{
+  int argc;
+  char **argv; // NULL-terminated
+  int nredirs;
+  redir_action *redirs;
+} command_plan;
+
+#endif
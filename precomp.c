@@ -0,0 +1,542 @@
+/* Copyright (C) 2021 by Alexandru-Sergiu Marton
+
+   This file is part of shell243.
+   
+   shell243 is free software: you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+   
+   shell243 is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+   
+   You should have received a copy of the GNU General Public License
+   along with shell243.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "precomp.h"
+
+#define PRECOMP_MAGIC 0x43333432 // "243C"
+#define PRECOMP_VERSION 2
+#define PRECOMP_SUFFIX ".243c"
+
+// The file is the header followed by:
+//   disk_line lines[nlines];     the root node of each line
+//   disk_node nodes[nnodes];     each line's nodes, children first
+//   uint32_t  kids[nkids];       the children of every node
+//   char      strings[strings_size];
+
+typedef struct precomp_header
+{
+  uint32_t magic, version;
+  uint64_t size, ino, hash; // of the source
+  int64_t mtime_sec, mtime_nsec;
+  uint32_t nlines, nnodes, nkids, strings_size;
+} precomp_header;
+
+typedef struct disk_line
+{
+  uint64_t offset; // where the line starts in the source
+  uint32_t root, unused;
+} disk_line;
+
+typedef struct disk_node
+{
+  uint32_t type;
+  int32_t value; // string offset, number or operator
+  uint32_t kids; // index of the first child in kids
+  uint32_t len;
+} disk_node;
+
+struct precomp_writer
+{
+  precomp_header header; // of the source, taken before it is parsed
+  disk_line *lines;
+  disk_node *nodes;
+  uint32_t *kids;
+  char *strings;
+  size_t nlines, nnodes, nkids, strings_size;
+  size_t lines_cap, nodes_cap, kids_cap, strings_cap;
+};
+
+struct precompiled
+{
+  void *map;
+  size_t map_size;
+  const precomp_header *header;
+  const disk_line *lines;
+  const disk_node *nodes;
+  const uint32_t *kids;
+  char *strings;
+};
+
+// Makes room for `n' more elements of `size' bytes in `*array'.
+static void
+reserve (void *array, size_t *cap, size_t len, size_t n, size_t size)
+{
+  if (len + n <= *cap)
+    return;
+
+  while (len + n > *cap)
+    *cap = *cap ? *cap * 2 : 64;
+  *(void **) array = realloc (*(void **) array, *cap * size);
+}
+
+static char *
+precomp_path (const char *script)
+{
+  char *path = (char *) malloc (strlen (script) + sizeof (PRECOMP_SUFFIX));
+  strcpy (path, script);
+  strcat (path, PRECOMP_SUFFIX);
+  return path;
+}
+
+static uint64_t
+hash_bytes (const unsigned char *s, size_t len)
+{
+  uint64_t h = 14695981039346656037u;
+  for (size_t i = 0; i < len; i++)
+    h = (h ^ s[i]) * 1099511628211u;
+  return h;
+}
+
+// Hashes the `size' bytes of the open file `fd'.
+static uint64_t
+hash_file (int fd, size_t size)
+{
+  if (size == 0)
+    return hash_bytes (NULL, 0);
+
+  void *text = mmap (NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (text == MAP_FAILED)
+    return 0;
+  uint64_t h = hash_bytes ((const unsigned char *) text, size);
+  munmap (text, size);
+  return h;
+}
+
+static bool
+describe_source (const char *script, precomp_header *h)
+{
+  struct stat st;
+  int fd = open (script, O_RDONLY | O_CLOEXEC);
+  if (fd == -1 || fstat (fd, &st) == -1)
+    {
+      perror (script);
+      if (fd != -1)
+	close (fd);
+      return false;
+    }
+
+  h->size = st.st_size;
+  h->ino = st.st_ino;
+  h->mtime_sec = st.st_mtim.tv_sec;
+  h->mtime_nsec = st.st_mtim.tv_nsec;
+  h->hash = hash_file (fd, st.st_size);
+  close (fd);
+
+  return true;
+}
+
+precomp_writer *
+precomp_writer_new (const char *script)
+{
+  precomp_writer *w = (precomp_writer *) calloc (1, sizeof (precomp_writer));
+  if (!describe_source (script, &w->header))
+    {
+      free (w);
+      return NULL;
+    }
+  return w;
+}
+
+static uint32_t
+add_string (precomp_writer *w, const char *s)
+{
+  size_t len = strlen (s) + 1;
+  reserve (&w->strings, &w->strings_cap, w->strings_size, len, 1);
+  memcpy (w->strings + w->strings_size, s, len);
+  w->strings_size += len;
+  return w->strings_size - len;
+}
+
+// Writes the node and returns its index. Its children are already in
+// `index', at the given positions.
+static uint32_t
+add_node (precomp_writer *w, const ast_node *node, const uint32_t *index)
+{
+  disk_node d = { node->type, 0, w->nkids, node->len };
+  if (node->type == AST_NUMBER)
+    d.value = node->number;
+  else if (node->type == AST_REDIR_OP)
+    d.value = node->op;
+  else if (node->type == AST_WORD || node->type == AST_ERROR)
+    d.value = add_string (w, node->string);
+
+  reserve (&w->kids, &w->kids_cap, w->nkids, node->len, sizeof (uint32_t));
+  memcpy (w->kids + w->nkids, index, sizeof (uint32_t) * node->len);
+  w->nkids += node->len;
+
+  reserve (&w->nodes, &w->nodes_cap, w->nnodes, 1, sizeof (disk_node));
+  w->nodes[w->nnodes] = d;
+  return w->nnodes++;
+}
+
+void
+precomp_add (precomp_writer *w, const ast_node *ast, size_t offset)
+{
+  // Post-order walk with an explicit stack, since and-or chains can be
+  // very deep. `done' holds the indices of finished children, which
+  // are consumed by their parent.
+  typedef struct frame { const ast_node *node; int next; } frame;
+  frame *stack = NULL;
+  uint32_t *done = NULL;
+  size_t depth = 0, stack_cap = 0, ndone = 0, done_cap = 0;
+
+  reserve (&stack, &stack_cap, depth, 1, sizeof (frame));
+  stack[depth++] = (frame) { ast, 0 };
+  while (depth > 0)
+    {
+      frame *f = &stack[depth - 1];
+      if (f->next < f->node->len)
+	{
+	  const ast_node *child = f->node->children[f->next++];
+	  reserve (&stack, &stack_cap, depth, 1, sizeof (frame));
+	  stack[depth++] = (frame) { child, 0 };
+	  continue;
+	}
+
+      ndone -= f->node->len;
+      uint32_t index = add_node (w, f->node, done + ndone);
+      reserve (&done, &done_cap, ndone, 1, sizeof (uint32_t));
+      done[ndone++] = index;
+      depth--;
+    }
+
+  reserve (&w->lines, &w->lines_cap, w->nlines, 1, sizeof (disk_line));
+  w->lines[w->nlines++] = (disk_line) { offset, done[0], 0 };
+
+  free (stack);
+  free (done);
+}
+
+static bool
+write_all (int fd, const void *buf, size_t len)
+{
+  const char *p = (const char *) buf;
+  while (len > 0)
+    {
+      ssize_t n = write (fd, p, len);
+      if (n == -1)
+	return false;
+      p += n;
+      len -= n;
+    }
+  return true;
+}
+
+static void
+writer_free (precomp_writer *w)
+{
+  free (w->lines);
+  free (w->nodes);
+  free (w->kids);
+  free (w->strings);
+  free (w);
+}
+
+bool
+precomp_save (precomp_writer *w, const char *script)
+{
+  precomp_header h = w->header;
+  h.magic = PRECOMP_MAGIC;
+  h.version = PRECOMP_VERSION;
+  h.nlines = w->nlines;
+  h.nnodes = w->nnodes;
+  h.nkids = w->nkids;
+  h.strings_size = w->strings_size;
+
+  char *path = precomp_path (script);
+  char *tmp = (char *) malloc (strlen (path) + 16);
+  sprintf (tmp, "%s.%d", path, (int) getpid ());
+
+  // Written under another name first, so that a run of the script
+  // never maps a half-written file.
+  int fd = open (tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  bool ok = fd != -1 && write_all (fd, &h, sizeof (h))
+    && write_all (fd, w->lines, sizeof (disk_line) * w->nlines)
+    && write_all (fd, w->nodes, sizeof (disk_node) * w->nnodes)
+    && write_all (fd, w->kids, sizeof (uint32_t) * w->nkids)
+    && write_all (fd, w->strings, w->strings_size);
+  if (fd != -1 && close (fd) == -1)
+    ok = false;
+  if (ok && rename (tmp, path) == -1)
+    ok = false;
+  if (!ok)
+    {
+      perror (path);
+      unlink (tmp);
+    }
+
+  free (tmp);
+  free (path);
+  writer_free (w);
+
+  return ok;
+}
+
+// Whether a node of type `parent' can have a child of type `child'.
+static bool
+fits (uint32_t parent, uint32_t child)
+{
+  if (child == AST_ERROR)
+    return true;
+
+  switch (parent)
+    {
+    case AST_PROGRAM:
+      return child == AST_SEMI || child == AST_AMP || child == AST_AND
+	|| child == AST_OR || child == AST_PIPE_SEQ || child == AST_TIME;
+    case AST_AND:
+    case AST_OR:
+    case AST_TIME:
+      return child == AST_AND || child == AST_OR || child == AST_PIPE_SEQ
+	|| child == AST_TIME;
+    case AST_PIPE_SEQ:
+      return child == AST_COMMAND;
+    case AST_COMMAND:
+      return child == AST_WORD || child == AST_REDIRECT;
+    case AST_REDIRECT:
+      return child == AST_NUMBER || child == AST_REDIR_OP
+	|| child == AST_WORD;
+    default:
+      return false;
+    }
+}
+
+// Checks the nodes of one line, `first' to `root', against the sizes
+// in the header, and that they have the shape the parser gives a tree,
+// since precomp_load and the evaluator trust both. Only the lines that
+// are run get checked, so this costs what loading them costs.
+static bool
+valid_line (const precompiled *p, uint32_t first, uint32_t root)
+{
+  const precomp_header *h = p->header;
+  if (root < first || root >= h->nnodes)
+    return false;
+
+  uint32_t type = p->nodes[root].type;
+  if (type != AST_PROGRAM && type != AST_ERROR)
+    return false;
+
+  for (uint32_t n = first; n <= root; n++)
+    {
+      const disk_node *d = &p->nodes[n];
+      if (d->type > AST_ERROR || d->len > h->nkids
+	  || d->kids > h->nkids - d->len)
+	return false;
+
+      for (uint32_t k = 0; k < d->len; k++)
+	{
+	  uint32_t kid = p->kids[d->kids + k];
+	  if (kid < first || kid >= n || !fits (d->type, p->nodes[kid].type))
+	    return false;
+	}
+
+      switch (d->type)
+	{
+	case AST_WORD:
+	case AST_ERROR:
+	  if (d->len != 0 || (uint32_t) d->value >= h->strings_size)
+	    return false;
+	  break;
+	case AST_AND:
+	case AST_OR:
+	  if (d->len != 2)
+	    return false;
+	  break;
+	case AST_TIME:
+	  if (d->len != 1)
+	    return false;
+	  break;
+	case AST_PIPE_SEQ:
+	  if (d->len == 0)
+	    return false;
+	  break;
+	case AST_REDIRECT:
+	  {
+	    // [NUMBER] REDIR_OP WORD
+	    const uint32_t *kids = p->kids + d->kids;
+	    if ((d->len != 2 && d->len != 3)
+		|| p->nodes[kids[d->len - 2]].type != AST_REDIR_OP
+		|| p->nodes[kids[d->len - 1]].type != AST_WORD
+		|| (d->len == 3 && p->nodes[kids[0]].type != AST_NUMBER))
+	      return false;
+	  }
+	  break;
+	default:
+	  break;
+	}
+    }
+
+  return true;
+}
+
+precompiled *
+precomp_open (const char *script)
+{
+  struct stat src, st;
+  int src_fd = open (script, O_RDONLY | O_CLOEXEC);
+  if (src_fd == -1)
+    return NULL;
+  if (fstat (src_fd, &src) == -1)
+    {
+      close (src_fd);
+      return NULL;
+    }
+
+  char *path = precomp_path (script);
+  int fd = open (path, O_RDONLY | O_CLOEXEC);
+  free (path);
+  if (fd == -1)
+    {
+      close (src_fd);
+      return NULL;
+    }
+
+  void *map = MAP_FAILED;
+  if (fstat (fd, &st) == 0 && (size_t) st.st_size >= sizeof (precomp_header))
+    // Private and writable, so that nothing done to the tree's strings
+    // can reach the file.
+    map = mmap (NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close (fd);
+  if (map == MAP_FAILED)
+    {
+      close (src_fd);
+      return NULL;
+    }
+
+  const precomp_header *h = (const precomp_header *) map;
+  size_t expected = sizeof (precomp_header)
+    + sizeof (disk_line) * (size_t) h->nlines
+    + sizeof (uint32_t) * (size_t) h->nkids
+    + sizeof (disk_node) * (size_t) h->nnodes + h->strings_size;
+  const char *end = (const char *) map + st.st_size;
+  // Timestamps are coarse, so an edit in the same tick as the compile
+  // keeps the mtime. Only then is the text itself compared.
+  bool racy = src.st_mtim.tv_sec > st.st_mtim.tv_sec
+    || (src.st_mtim.tv_sec == st.st_mtim.tv_sec
+	&& src.st_mtim.tv_nsec >= st.st_mtim.tv_nsec);
+  if (h->magic != PRECOMP_MAGIC || h->version != PRECOMP_VERSION
+      || expected != (size_t) st.st_size
+      || (h->strings_size > 0 && end[-1] != '\0')
+      || h->size != (uint64_t) src.st_size || h->ino != src.st_ino
+      || h->mtime_sec != src.st_mtim.tv_sec
+      || h->mtime_nsec != src.st_mtim.tv_nsec
+      || (racy && h->hash != hash_file (src_fd, src.st_size)))
+    {
+      close (src_fd);
+      munmap (map, st.st_size);
+      return NULL;
+    }
+  close (src_fd);
+
+  precompiled *p = (precompiled *) malloc (sizeof (precompiled));
+  p->map = map;
+  p->map_size = st.st_size;
+  p->header = h;
+  p->lines = (const disk_line *) (h + 1);
+  p->nodes = (const disk_node *) (p->lines + h->nlines);
+  p->kids = (const uint32_t *) (p->nodes + h->nnodes);
+  p->strings = (char *) (p->kids + h->nkids);
+
+  return p;
+}
+
+int
+precomp_count (const precompiled *p)
+{
+  return p->header->nlines;
+}
+
+ast_node *
+precomp_load (const precompiled *p, int i, arena *a)
+{
+  // A line's nodes are contiguous and come after its children, so one
+  // pass in file order builds the tree bottom up.
+  uint32_t first = i == 0 ? 0 : p->lines[i - 1].root + 1;
+  uint32_t root = p->lines[i].root;
+  if (!valid_line (p, first, root))
+    return NULL;
+
+  ast_node **made = (ast_node **) arena_alloc (a, sizeof (ast_node *)
+					       * (root - first + 1));
+
+  for (uint32_t n = first; n <= root; n++)
+    {
+      const disk_node *d = &p->nodes[n];
+      ast_node *node = (ast_node *) arena_alloc (a, sizeof (ast_node));
+      node->type = (ast_node_type) d->type;
+      node->len = node->cap = d->len;
+      node->children = NULL;
+      node->string = NULL;
+
+      if (d->len > 0)
+	{
+	  node->children = (ast_node **) arena_alloc (a, sizeof (ast_node *)
+						      * d->len);
+	  for (uint32_t k = 0; k < d->len; k++)
+	    node->children[k] = made[p->kids[d->kids + k] - first];
+	}
+
+      switch (node->type)
+	{
+	case AST_NUMBER:
+	  node->number = d->value;
+	  break;
+	case AST_REDIR_OP:
+	  node->op = (token_type) d->value;
+	  break;
+	case AST_WORD:
+	case AST_ERROR:
+	  node->string = p->strings + d->value;
+	  node->length = strlen (node->string);
+	  break;
+	case AST_COMMAND:
+	  node->plan = make_plan (a, node);
+	  break;
+	default:
+	  break;
+	}
+
+      made[n - first] = node;
+    }
+
+  return made[root - first];
+}
+
+size_t
+precomp_offset (const precompiled *p, int i)
+{
+  return p->lines[i].offset;
+}
+
+void
+precomp_close (precompiled *p)
+{
+  munmap (p->map, p->map_size);
+  free (p);
+}
@@ -0,0 +1,77 @@
+/* Copyright (C) 2021 by Alexandru-Sergiu Marton
+
+   This file is part of shell243.
+   
+   shell243 is free software: you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+   
+   shell243 is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+   
+   You should have received a copy of the GNU General Public License
+   along with shell243.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef SH243_PRECOMP_H
+#define SH243_PRECOMP_H
+
+#include <stdbool.h>
+
+#include "parser.h"
+#include "arena.h"
+
+// Precompiled scripts: "shell243 -C script" parses every line of
+// script and saves the trees in script.243c, which later runs of the
+// script map into memory instead of lexing and parsing it again. The
+// file has no pointers, only indices into its node and string tables.
+// Opening it costs a stat of the source, so startup doesn't grow with
+// the script; each line run is checked and rebuilt in an arena, a
+// node at a time, at a cost proportional to its own size. A file made
+// for another version of the source (by size, mtime and inode, and by
+// a hash of its text when the mtime is too close to the compile to
+// trust) is ignored. A line that doesn't hold together sends the
+// shell back to parsing the source from that line on.
+
+typedef struct precomp_writer precomp_writer;
+typedef struct precompiled precompiled;
+
+// Records the state of `script' before any of it is parsed, or
+// returns NULL if it can't be read.
+precomp_writer *
+precomp_writer_new (const char *script);
+
+// Adds the tree of the script's next line, which starts at byte
+// `offset' of the source.
+void
+precomp_add (precomp_writer *w, const ast_node *ast, size_t offset);
+
+// Writes the trees added to `w' as the precompiled form of `script',
+// and frees `w'.
+bool
+precomp_save (precomp_writer *w, const char *script);
+
+// Maps the precompiled form of `script', or returns NULL if there
+// isn't an up to date one.
+precompiled *
+precomp_open (const char *script);
+
+int
+precomp_count (const precompiled *p);
+
+// Builds the tree of line `i' in `a', or returns NULL if its part of
+// the file doesn't hold together. Its strings point into the mapping.
+ast_node *
+precomp_load (const precompiled *p, int i, arena *a);
+
+// Where line `i' starts in the source.
+size_t
+precomp_offset (const precompiled *p, int i);
+
+void
+precomp_close (precompiled *p);
+
+#endif
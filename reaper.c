@@ -0,0 +1,158 @@
+/* Copyright (C) 2021 by Alexandru-Sergiu Marton
+
+   This file is part of shell243.
+   
+   shell243 is free software: you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+   
+   shell243 is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+   
+   You should have received a copy of the GNU General Public License
+   along with shell243.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#define _POSIX_C_SOURCE 200809L
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+#include "reaper.h"
+#include "job.h"
+
+static int self_pipe[2] = { -1, -1 };
+
+// Children reap_children collected that aren't jobs, until their
+// pipe_wait claims them.
+typedef struct stray
+{
+  pid_t pid;
+  int wstatus;
+  struct rusage usage;
+} stray;
+
+static stray *strays = NULL;
+static int nstrays = 0, strays_cap = 0;
+
+static void
+on_sigchld (int sig)
+{
+  (void) sig;
+  int saved_errno = errno;
+  (void) !write (self_pipe[1], "", 1);
+  errno = saved_errno;
+}
+
+void
+reaper_init ()
+{
+  if (pipe2 (self_pipe, O_CLOEXEC | O_NONBLOCK) == -1)
+    {
+      perror ("reaper: pipe2");
+      return;
+    }
+
+  struct sigaction sa;
+  sa.sa_handler = on_sigchld;
+  sigemptyset (&sa.sa_mask);
+  sa.sa_flags = SA_RESTART;
+  sigaction (SIGCHLD, &sa, NULL);
+}
+
+void
+reaper_reset ()
+{
+  signal (SIGCHLD, SIG_DFL);
+  if (self_pipe[0] != -1)
+    {
+      close (self_pipe[0]);
+      close (self_pipe[1]);
+      self_pipe[0] = self_pipe[1] = -1;
+    }
+}
+
+int
+reaper_fd ()
+{
+  return self_pipe[0];
+}
+
+void
+reaper_clear ()
+{
+  char buf[64];
+  while (self_pipe[0] != -1 && read (self_pipe[0], buf, sizeof (buf)) > 0)
+    ;
+}
+
+bool
+reaper_dispatch (pid_t pid, int wstatus)
+{
+  job *j = job_find (pid);
+  if (j)
+    job_update (j, wstatus);
+  return j != NULL;
+}
+
+static void
+keep_stray (pid_t pid, int wstatus, const struct rusage *usage)
+{
+  if (nstrays == strays_cap)
+    {
+      strays_cap = strays_cap ? strays_cap * 2 : 8;
+      strays = (stray *) realloc (strays, sizeof (stray) * strays_cap);
+    }
+  strays[nstrays++] = (stray) { pid, wstatus, *usage };
+}
+
+bool
+reaper_claim (pid_t pid, int *wstatus, struct rusage *usage)
+{
+  for (int i = 0; i < nstrays; i++)
+    if (strays[i].pid == pid)
+      {
+	*wstatus = strays[i].wstatus;
+	*usage = strays[i].usage;
+	strays[i] = strays[--nstrays];
+	return true;
+      }
+  return false;
+}
+
+int
+reap_children ()
+{
+  reaper_clear ();
+
+  // Besides background jobs, this can collect the earlier stages of a
+  // pipe sequence whose last stage is a builtin running in the shell
+  // (jobs, wait). Those are kept for pipe_wait to claim.
+  int count = 0;
+  for (;;)
+    {
+      int wstatus;
+      struct rusage usage;
+      pid_t pid = wait4 (-1, &wstatus, WNOHANG | WUNTRACED | WCONTINUED,
+			 &usage);
+      if (pid <= 0)
+	break;
+
+      if (!reaper_dispatch (pid, wstatus)
+	  && (WIFEXITED (wstatus) || WIFSIGNALED (wstatus)))
+	keep_stray (pid, wstatus, &usage);
+      count++;
+    }
+
+  return count;
+}
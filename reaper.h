@@ -0,0 +1,62 @@
+/* Copyright (C) 2021 by Alexandru-Sergiu Marton
+
+   This file is part of shell243.
+   
+   shell243 is free software: you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+   
+   shell243 is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+   
+   You should have received a copy of the GNU General Public License
+   along with shell243.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef SH243_REAPER_H
+#define SH243_REAPER_H
+
+#include <stdbool.h>
+#include <sys/types.h>
+#include <sys/resource.h>
+
+// SIGCHLD only writes a byte to a pipe; the children themselves are
+// reaped synchronously by reap_children, so foreground waits never race
+// with a signal handler.
+
+void
+reaper_init ();
+
+// Undoes reaper_init in a forked subshell.
+void
+reaper_reset ();
+
+// Becomes readable when a child has changed state.
+int
+reaper_fd ();
+
+// Empties the pipe behind reaper_fd without reaping anything, for
+// callers that do their own waitpid.
+void
+reaper_clear ();
+
+// Records a state change of `pid' collected by some other waitpid(-1)
+// caller. Returns false if `pid' isn't a background job.
+bool
+reaper_dispatch (pid_t pid, int wstatus);
+
+// Collects every child that has changed state and updates its job.
+// Returns how many there were.
+int
+reap_children ();
+
+// Hands over the status of `pid' if reap_children collected it without
+// it being a job: a pipe sequence stage whose last stage is a builtin
+// that reaps.
+bool
+reaper_claim (pid_t pid, int *wstatus, struct rusage *usage);
+
+#endif
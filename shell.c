@@ -18,21 +18,120 @@
    along with shell243.  If not, see <https://www.gnu.org/licenses/>.
 */
 
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <string.h>
+#include <ctype.h>
 #include <signal.h>
+#include <unistd.h>
+#include <poll.h>
+#include <errno.h>
 #include <readline/readline.h>
 #include <readline/history.h>
 
 #include "parser.h"
 #include "eval.h"
+#include "reaper.h"
+#include "stats.h"
+#include "astcache.h"
+#include "precomp.h"
 #include "debug.h"
+#include "jobout.h"
 
-int
-main ()
+static int
+run_line (char *line)
+{
+  int status = 2;
+  size_t len = strlen (line);
+
+  bool worth;
+  const ast_node *cached = astcache_lookup (line, len, &worth);
+  if (cached)
+    return eval (cached);
+
+  // The lexer rewrites the line in place, so keep the original for the
+  // cache.
+  char *key = NULL;
+  if (worth)
+    {
+      key = (char *) malloc (len + 1);
+      memcpy (key, line, len + 1);
+    }
+
+  init_lexer (line);
+  uint64_t start = stat_now ();
+  ast_node *ast = parse ();
+  stat_record (STAT_PARSE, start);
+#ifdef DEBUG
+  print_ast (ast, 0);
+#endif
+  if (!check_ast_error (ast))
+    {
+      if (key)
+	astcache_insert (key, len, ast);
+      status = eval (ast);
+    }
+  parser_reset ();
+  free (key);
+
+  return status;
+}
+
+// Blank lines and lines starting with '#' (which covers the "#!"
+// line of a script) are skipped in non-interactive mode.
+static bool
+is_ignorable (const char *line)
+{
+  while (isspace ((unsigned char) *line))
+    line++;
+  return *line == '\0' || *line == '#';
+}
+
+// Waits for input the way readline would, but also wakes up when a
+// background job changes state so that the job table is up to date
+// before the next prompt.
+static int
+getc_or_reap (FILE *stream)
+{
+  struct pollfd fds[3] = {
+    { .fd = fileno (stream), .events = POLLIN },
+    { .fd = reaper_fd (), .events = POLLIN },
+    { .fd = -1, .events = POLLIN }
+  };
+
+  for (;;)
+    {
+      fds[2].fd = jobout_fd ();
+      int n = poll (fds, 3, -1);
+      if (n == -1 && errno != EINTR)
+	break;
+      if (n > 0 && (fds[0].revents & (POLLIN | POLLHUP | POLLERR)))
+	break;
+      if (n > 0 && (fds[1].revents & POLLIN))
+	{
+	  reap_children ();
+	  start_queued_jobs ();
+	}
+      if (n > 0 && fds[2].revents)
+	{
+	  // Job output goes above the line being edited.
+	  rl_clear_visible_line ();
+	  jobout_drain ();
+	  rl_forced_update_display ();
+	}
+    }
+
+  return rl_getc (stream);
+}
+
+static int
+run_interactive ()
 {
   signal (SIGINT, SIG_IGN);
+  rl_getc_function = getc_or_reap;
 
   while (true)
     {
@@ -42,14 +141,7 @@ main ()
       if (*line)
 	{
 	  add_history (line);
-	  init_lexer (line);
-	  ast_node *ast = parse ();
-#ifdef DEBUG
-	  print_ast (ast, 0);
-#endif
-	  if (!check_ast_error (ast))
-	    eval (ast);
-	  ast_free (ast);
+	  run_line (line);
 	}
       else
 	check_bg_processes ();
@@ -58,3 +150,211 @@ main ()
     }
   return 0;
 }
+
+// Reads and evaluates one line at a time, so memory use does not
+// depend on the size of the script.
+// If `shared', the commands run may read `in' too, so each line is run
+// with the fd's offset just past it.
+static int
+run_stream (FILE *in, bool shared)
+{
+  int status = EXIT_SUCCESS;
+  char *line = NULL;
+  size_t cap = 0;
+  ssize_t n;
+
+  while ((n = getline (&line, &cap, in)) != -1)
+    {
+      if (n > 0 && line[n - 1] == '\n')
+	line[n - 1] = '\0';
+      if (is_ignorable (line))
+	continue;
+      // Gives back what was read ahead, by seeking the fd back to the
+      // stream's position.
+      if (shared)
+	fflush (in);
+      status = run_line (line);
+    }
+
+  free (line);
+  return status;
+}
+
+// A script on stdin shares it with its commands, which must see the
+// rest of it. A file is read in blocks, the rest given back before a
+// line runs; a pipe can't be sought, so it is read a byte at a time.
+static int
+run_stdin ()
+{
+  if (lseek (STDIN_FILENO, 0, SEEK_CUR) == -1)
+    setvbuf (stdin, NULL, _IONBF, 0);
+  return run_stream (stdin, true);
+}
+
+// Parses every line of `path' into its precompiled form.
+static int
+compile_script (const char *path)
+{
+  FILE *script = fopen (path, "re");
+  if (!script)
+    {
+      perror (path);
+      return 127;
+    }
+
+  precomp_writer *w = precomp_writer_new (path);
+  if (!w)
+    {
+      fclose (script);
+      return 127;
+    }
+
+  char *line = NULL;
+  size_t cap = 0, offset = 0;
+  ssize_t n;
+
+  for (; (n = getline (&line, &cap, script)) != -1; offset += n)
+    {
+      if (n > 0 && line[n - 1] == '\n')
+	line[n - 1] = '\0';
+      if (is_ignorable (line))
+	continue;
+
+      init_lexer (line);
+      precomp_add (w, parse (), offset);
+      parser_reset ();
+    }
+
+  free (line);
+  fclose (script);
+
+  return precomp_save (w, path) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// Runs the script at `path' from byte `offset' on.
+static int
+run_script (const char *path, size_t offset)
+{
+  FILE *script = fopen (path, "re");
+  if (!script)
+    {
+      perror (path);
+      return 127;
+    }
+  if (offset > 0 && fseeko (script, offset, SEEK_SET) == -1)
+    {
+      perror (path);
+      fclose (script);
+      return 127;
+    }
+
+  int status = run_stream (script, false);
+  fclose (script);
+  return status;
+}
+
+static int
+run_precompiled (precompiled *p, const char *path)
+{
+  int status = EXIT_SUCCESS;
+  arena line_arena = { 0 };
+
+  for (int i = 0; i < precomp_count (p); i++)
+    {
+      ast_node *ast = precomp_load (p, i, &line_arena);
+      if (!ast)
+	{
+	  status = run_script (path, precomp_offset (p, i));
+	  break;
+	}
+#ifdef DEBUG
+      print_ast (ast, 0);
+#endif
+      status = check_ast_error (ast) ? 2 : eval (ast);
+      arena_reset (&line_arena);
+    }
+
+  arena_release (&line_arena);
+  return status;
+}
+
+// The command string of -c is split on newlines in place.
+static int
+run_string (char *cmd)
+{
+  int status = EXIT_SUCCESS;
+
+  while (cmd)
+    {
+      char *newline = strchr (cmd, '\n');
+      if (newline)
+	*newline = '\0';
+      if (!is_ignorable (cmd))
+	status = run_line (cmd);
+      cmd = newline ? newline + 1 : NULL;
+    }
+
+  return status;
+}
+
+static void
+usage (const char *progname)
+{
+  fprintf (stderr, "usage: %s [-c command | [-C] file]\n", progname);
+  exit (2);
+}
+
+int
+main (int argc, char **argv)
+{
+  char *command = NULL;
+  bool compile_only = false;
+  int opt;
+
+  while ((opt = getopt (argc, argv, "c:C")) != -1)
+    switch (opt)
+      {
+      case 'c':
+	command = optarg;
+	break;
+      case 'C':
+	compile_only = true;
+	break;
+      default:
+	usage (argv[0]);
+      }
+
+  if (compile_only)
+    {
+      if (command || optind >= argc)
+	usage (argv[0]);
+      return compile_script (argv[optind]);
+    }
+
+  reaper_init ();
+  // cat and tee run in the shell and must see EPIPE, not die of it.
+  signal (SIGPIPE, SIG_IGN);
+
+  int status;
+  precompiled *compiled;
+  if (command)
+    status = run_string (command);
+  else if (optind < argc && (compiled = precomp_open (argv[optind])))
+    {
+      status = run_precompiled (compiled, argv[optind]);
+      precomp_close (compiled);
+    }
+  else if (optind < argc)
+    status = run_script (argv[optind], 0);
+  else if (!isatty (STDIN_FILENO))
+    status = run_stdin ();
+  else
+    status = run_interactive ();
+
+  // Jobs held back by set -o maxjobs still have to run, and the output
+  // of the jobs under set -o jobout has to be printed.
+  finish_queued_jobs ();
+  jobout_finish ();
+
+  return status;
+}
@@ -0,0 +1,126 @@
+/* Copyright (C) 2021 by Alexandru-Sergiu Marton
+
+   This file is part of shell243.
+   
+   shell243 is free software: you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+   
+   shell243 is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+   
+   You should have received a copy of the GNU General Public License
+   along with shell243.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <spawn.h>
+#include <signal.h>
+#include <errno.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "spawner.h"
+#include "fds.h"
+
+extern char **environ;
+
+static void
+close_all (const int *fds, int n)
+{
+  for (int i = 0; i < n; i++)
+    close (fds[i]);
+}
+
+// posix_spawn lets glibc use clone(CLONE_VM | CLONE_VFORK), so starting a
+// command doesn't copy the shell's page tables the way fork does.
+pid_t
+spawn_process (const char *path, char *const argv[], int in_fd, int out_fd,
+	       const redir_action *redirs, int nredirs)
+{
+  posix_spawn_file_actions_t actions;
+  posix_spawnattr_t attr;
+  sigset_t defaults;
+  pid_t pid;
+  int err;
+
+  // Redirect targets are opened here rather than by the child, so that
+  // one that can't be opened is reported by its own name instead of
+  // failing the spawn as if the command were missing.
+  int opened[nredirs > 0 ? nredirs : 1];
+  for (int i = 0; i < nredirs; i++)
+    {
+      int fd = open (redirs[i].path, redirs[i].flags | O_CLOEXEC,
+		     S_IRUSR | S_IWUSR);
+      if (fd != -1 && (opened[i] = fd_dup (fd)) != -1)
+	close (fd);
+      else
+	{
+	  perror (redirs[i].path);
+	  if (fd != -1)
+	    close (fd);
+	  close_all (opened, i);
+	  return SPAWN_BAD_REDIRECT;
+	}
+    }
+
+#ifdef DEBUG
+  fd_check_inherited (argv[0], in_fd, out_fd);
+#endif
+
+  posix_spawn_file_actions_init (&actions);
+  if (in_fd != STDIN_FILENO)
+    {
+      posix_spawn_file_actions_adddup2 (&actions, in_fd, STDIN_FILENO);
+      posix_spawn_file_actions_addclose (&actions, in_fd);
+    }
+  if (out_fd != STDOUT_FILENO)
+    {
+      posix_spawn_file_actions_adddup2 (&actions, out_fd, STDOUT_FILENO);
+      posix_spawn_file_actions_addclose (&actions, out_fd);
+    }
+  for (int i = 0; i < nredirs; i++)
+    {
+      posix_spawn_file_actions_adddup2 (&actions, opened[i], redirs[i].fd);
+      if (opened[i] != redirs[i].fd)
+	posix_spawn_file_actions_addclose (&actions, opened[i]);
+    }
+
+  // The shell ignores these, and ignored signals survive exec.
+  posix_spawnattr_init (&attr);
+  sigemptyset (&defaults);
+  sigaddset (&defaults, SIGINT);
+  sigaddset (&defaults, SIGTSTP);
+  sigaddset (&defaults, SIGPIPE);
+  posix_spawnattr_setsigdefault (&attr, &defaults);
+  posix_spawnattr_setflags (&attr, POSIX_SPAWN_SETSIGDEF);
+
+  if (path)
+    {
+      err = posix_spawn (&pid, path, &actions, &attr, argv, environ);
+      // The hashed path may have gone stale. ENOENT also comes from a
+      // script whose interpreter is missing, which a search wouldn't
+      // change.
+      if (err == ENOENT && access (path, F_OK) == -1)
+	path = NULL;
+    }
+  if (!path)
+    err = posix_spawnp (&pid, argv[0], &actions, &attr, argv, environ);
+
+  posix_spawnattr_destroy (&attr);
+  posix_spawn_file_actions_destroy (&actions);
+  close_all (opened, nredirs);
+
+  if (err)
+    {
+      errno = err;
+      return -1;
+    }
+  return pid;
+}
@@ -0,0 +1,39 @@
+/* Copyright (C) 2021 by Alexandru-Sergiu Marton
+
+   This file is part of shell243.
+   
+   shell243 is free software: you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+   
+   shell243 is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+   
+   You should have received a copy of the GNU General Public License
+   along with shell243.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef SH243_SPAWNER_H
+#define SH243_SPAWNER_H
+
+#include <sys/types.h>
+
+#include "plan.h"
+
+// Returned by spawn_process when a redirect target can't be opened.
+#define SPAWN_BAD_REDIRECT (-2)
+
+// Starts argv[0] with stdin and stdout replaced by `in_fd' and
+// `out_fd', then applies `redirs' in order. `path' is where the
+// command was found in PATH, or NULL to search for it. Returns the pid
+// of the child, or -1 with errno set if it couldn't be started. A
+// redirect target that can't be opened is reported on stderr, and
+// nothing is started.
+pid_t
+spawn_process (const char *path, char *const argv[], int in_fd, int out_fd,
+	       const redir_action *redirs, int nredirs);
+
+#endif
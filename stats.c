@@ -0,0 +1,159 @@
+/* Copyright (C) 2021 by Alexandru-Sergiu Marton
+
+   This file is part of shell243.
+   
+   shell243 is free software: you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+   
+   shell243 is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+   
+   You should have received a copy of the GNU General Public License
+   along with shell243.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <inttypes.h>
+#include <time.h>
+
+#include "stats.h"
+
+stat_counter stats[STAT_COUNT];
+
+static const char *stat_names[STAT_COUNT] = {
+  [STAT_TOKENS] = "tokens",
+  [STAT_CACHE_HIT] = "cache_hit",
+  [STAT_CACHE_MISS] = "cache_miss",
+  [STAT_CACHE_EVICT] = "cache_evict",
+  [STAT_PARSE] = "parse",
+  [STAT_SPAWN] = "spawn",
+  [STAT_FORK] = "fork",
+  [STAT_BUILTIN] = "builtin",
+  [STAT_WAIT] = "wait",
+  [STAT_REAP] = "reap",
+};
+
+uint64_t
+stat_now ()
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+void
+stat_record (stat_id id, uint64_t start)
+{
+  uint64_t ns = stat_now () - start;
+  stat_counter *c = &stats[id];
+
+  int bucket = ns ? 64 - __builtin_clzll (ns) : 0;
+  if (bucket >= STAT_BUCKETS)
+    bucket = STAT_BUCKETS - 1;
+
+  c->count++;
+  c->total_ns += ns;
+  if (ns > c->max_ns)
+    c->max_ns = ns;
+  c->hist[bucket]++;
+}
+
+// An upper bound for the `pct' percentile, from the histogram.
+static uint64_t
+percentile (const stat_counter *c, int pct)
+{
+  uint64_t rank = (c->count * pct + 99) / 100, seen = 0;
+  for (int i = 0; i < STAT_BUCKETS; i++)
+    {
+      seen += c->hist[i];
+      if (seen >= rank && seen > 0)
+	{
+	  uint64_t bound = UINT64_C (1) << i;
+	  return i < STAT_BUCKETS - 1 && bound < c->max_ns ? bound : c->max_ns;
+	}
+    }
+  return c->max_ns;
+}
+
+static bool
+is_timed (int id)
+{
+  return id >= STAT_PARSE;
+}
+
+static void
+print_table ()
+{
+  printf ("%-11s %10s %12s %10s %10s %10s %10s\n", "counter", "count",
+	  "total us", "avg us", "p50 us", "p99 us", "max us");
+  for (int i = 0; i < STAT_COUNT; i++)
+    {
+      const stat_counter *c = &stats[i];
+      if (!is_timed (i))
+	{
+	  printf ("%-11s %10" PRIu64 "\n", stat_names[i], c->count);
+	  continue;
+	}
+
+      printf ("%-11s %10" PRIu64 " %12.1f %10.1f %10.1f %10.1f %10.1f\n",
+	      stat_names[i], c->count, c->total_ns / 1e3,
+	      c->count ? c->total_ns / 1e3 / c->count : 0.0,
+	      c->count ? percentile (c, 50) / 1e3 : 0.0,
+	      c->count ? percentile (c, 99) / 1e3 : 0.0, c->max_ns / 1e3);
+    }
+}
+
+static void
+print_machine ()
+{
+  for (int i = 0; i < STAT_COUNT; i++)
+    {
+      const stat_counter *c = &stats[i];
+      printf ("%s.count=%" PRIu64 "\n", stat_names[i], c->count);
+      if (!is_timed (i))
+	continue;
+
+      printf ("%s.total_ns=%" PRIu64 "\n", stat_names[i], c->total_ns);
+      printf ("%s.max_ns=%" PRIu64 "\n", stat_names[i], c->max_ns);
+      for (int b = 0; b < STAT_BUCKETS; b++)
+	if (c->hist[b])
+	  printf ("%s.hist.%d=%" PRIu64 "\n", stat_names[i], b, c->hist[b]);
+    }
+}
+
+int
+builtin_shstat (int argc, char **argv)
+{
+  bool machine = false, reset = false;
+
+  for (int i = 1; i < argc; i++)
+    if (strcmp (argv[i], "-m") == 0)
+      machine = true;
+    else if (strcmp (argv[i], "-r") == 0)
+      reset = true;
+    else
+      {
+	fprintf (stderr, "shstat: %s: invalid option\n"
+		 "usage: shstat [-m] [-r]\n", argv[i]);
+	return 2;
+      }
+
+  if (machine)
+    print_machine ();
+  else if (!reset)
+    print_table ();
+
+  if (reset)
+    memset (stats, 0, sizeof (stats));
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,78 @@
+/* Copyright (C) 2021 by Alexandru-Sergiu Marton
+
+   This file is part of shell243.
+   
+   shell243 is free software: you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+   
+   shell243 is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+   
+   You should have received a copy of the GNU General Public License
+   along with shell243.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef SH243_STATS_H
+#define SH243_STATS_H
+
+#include <stdint.h>
+
+// Counters for the shell's own work. Each one counts events and, for
+// the timed ones, keeps the total, the maximum and a histogram of
+// durations with a bucket per power of two nanoseconds. Recording is a
+// clock read and a few adds, so they are always on.
+
+typedef enum stat_id
+{
+  // Counted only
+  STAT_TOKENS,       // next_token calls
+  STAT_CACHE_HIT,    // lines found in the AST cache
+  STAT_CACHE_MISS,
+  STAT_CACHE_EVICT,
+
+  // Timed
+  STAT_PARSE,        // parse, lexing included
+  STAT_SPAWN,        // posix_spawn of an external command
+  STAT_FORK,         // fork of a builtin stage or a background job
+  STAT_BUILTIN,      // builtins run in the shell
+  STAT_WAIT,         // the wait loop of a pipe sequence
+  STAT_REAP,         // check_bg_processes
+  STAT_COUNT
+} stat_id;
+
+#define STAT_BUCKETS 40
+
+typedef struct stat_counter
+{
+  uint64_t count;
+  uint64_t total_ns, max_ns;
+  uint64_t hist[STAT_BUCKETS]; // hist[i] counts durations < 2^i ns
+} stat_counter;
+
+extern stat_counter stats[STAT_COUNT];
+
+// Monotonic clock, in nanoseconds.
+uint64_t
+stat_now ();
+
+static inline void
+stat_count (stat_id id)
+{
+  stats[id].count++;
+}
+
+// Records an event of `id' that began at `start' (from stat_now).
+void
+stat_record (stat_id id, uint64_t start);
+
+// shstat       prints the counters in a table
+// shstat -m    prints them as name.field=value lines
+// shstat -r    resets them, after printing them if -m is given too
+int
+builtin_shstat (int argc, char **argv);
+
+#endif
@@ -0,0 +1,139 @@
+/* Copyright (C) 2021 by Alexandru-Sergiu Marton
+
+   This file is part of shell243.
+   
+   shell243 is free software: you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+   
+   shell243 is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+   
+   You should have received a copy of the GNU General Public License
+   along with shell243.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "timing.h"
+
+timing *current_timing = NULL;
+
+static double
+timeval_seconds (struct timeval tv)
+{
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static struct timeval
+timeval_sub (struct timeval a, struct timeval b)
+{
+  struct timeval r = { a.tv_sec - b.tv_sec, a.tv_usec - b.tv_usec };
+  if (r.tv_usec < 0)
+    {
+      r.tv_sec--;
+      r.tv_usec += 1000000;
+    }
+  return r;
+}
+
+double
+elapsed_since (const struct timespec *start)
+{
+  struct timespec now;
+  clock_gettime (CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+int
+timing_add_stage (timing *t, const char *name)
+{
+  if (t->len == t->cap)
+    {
+      t->cap = t->cap ? t->cap * 2 : 8;
+      t->stages = (stage_time *) realloc (t->stages,
+					  sizeof (stage_time) * t->cap);
+    }
+
+  stage_time *s = &t->stages[t->len++];
+  memset (s, 0, sizeof (stage_time));
+  s->name = name;
+  clock_gettime (CLOCK_MONOTONIC, &s->start);
+
+  return t->len - 1;
+}
+
+void
+rusage_diff (struct rusage *result, const struct rusage *after,
+	     const struct rusage *before)
+{
+  memset (result, 0, sizeof (struct rusage));
+  result->ru_utime = timeval_sub (after->ru_utime, before->ru_utime);
+  result->ru_stime = timeval_sub (after->ru_stime, before->ru_stime);
+  // The shell's own peak says nothing about the stage.
+  result->ru_maxrss = -1;
+  result->ru_nvcsw = after->ru_nvcsw - before->ru_nvcsw;
+  result->ru_nivcsw = after->ru_nivcsw - before->ru_nivcsw;
+}
+
+static void
+print_usage (const char *label, double real, const struct rusage *ru)
+{
+  char maxrss[32] = "n/a";
+  if (ru->ru_maxrss >= 0)
+    snprintf (maxrss, sizeof (maxrss), "%ld KiB", ru->ru_maxrss);
+
+  fprintf (stderr, "%-16s real %.3fs  user %.3fs  sys %.3fs  "
+	   "maxrss %s  ctxsw %ld/%ld\n", label, real,
+	   timeval_seconds (ru->ru_utime), timeval_seconds (ru->ru_stime),
+	   maxrss, ru->ru_nvcsw, ru->ru_nivcsw);
+}
+
+void
+timing_report (const timing *t, double real)
+{
+  struct rusage total;
+  memset (&total, 0, sizeof (total));
+  total.ru_maxrss = -1; // until a stage that ran as a child has one
+
+  for (int i = 0; i < t->len; i++)
+    {
+      const struct rusage *ru = &t->stages[i].usage;
+      total.ru_utime.tv_sec += ru->ru_utime.tv_sec;
+      total.ru_utime.tv_usec += ru->ru_utime.tv_usec;
+      total.ru_stime.tv_sec += ru->ru_stime.tv_sec;
+      total.ru_stime.tv_usec += ru->ru_stime.tv_usec;
+      if (ru->ru_maxrss > total.ru_maxrss)
+	total.ru_maxrss = ru->ru_maxrss;
+      total.ru_nvcsw += ru->ru_nvcsw;
+      total.ru_nivcsw += ru->ru_nivcsw;
+    }
+  total.ru_utime.tv_sec += total.ru_utime.tv_usec / 1000000;
+  total.ru_utime.tv_usec %= 1000000;
+  total.ru_stime.tv_sec += total.ru_stime.tv_usec / 1000000;
+  total.ru_stime.tv_usec %= 1000000;
+
+  print_usage ("total", real, &total);
+  if (t->len > 1)
+    for (int i = 0; i < t->len; i++)
+      {
+	char label[24];
+	snprintf (label, sizeof (label), "[%d] %s", i + 1, t->stages[i].name);
+	print_usage (label, t->stages[i].real, &t->stages[i].usage);
+      }
+}
+
+void
+timing_free (timing *t)
+{
+  free (t->stages);
+  t->stages = NULL;
+  t->len = t->cap = 0;
+}
@@ -0,0 +1,67 @@
+/* Copyright (C) 2021 by Alexandru-Sergiu Marton
+
+   This file is part of shell243.
+   
+   shell243 is free software: you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+   
+   shell243 is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+   
+   You should have received a copy of the GNU General Public License
+   along with shell243.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef SH243_TIMING_H
+#define SH243_TIMING_H
+
+#include <time.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+// Resource usage of every pipeline stage run under the time keyword.
+
+typedef struct stage_time
+{
+  const char *name;
+  struct timespec start;
+  double real;
+  struct rusage usage;
+} stage_time;
+
+typedef struct timing
+{
+  stage_time *stages;
+  int len, cap;
+} timing;
+
+// The innermost "time" being evaluated, or NULL.
+extern timing *current_timing;
+
+double
+elapsed_since (const struct timespec *start);
+
+// Adds a stage that starts now and returns its index; the array may
+// move as it grows.
+int
+timing_add_stage (timing *t, const char *name);
+
+// Stores in `result' the usage between `before' and `after', both
+// taken with getrusage (RUSAGE_SELF). Its ru_maxrss is -1, for not
+// applicable: a stage run in the shell has no peak of its own.
+void
+rusage_diff (struct rusage *result, const struct rusage *after,
+	     const struct rusage *before);
+
+void
+timing_report (const timing *t, double real);
+
+void
+timing_free (timing *t);
+
+#endif
@@ -0,0 +1,484 @@
+/* Copyright (C) 2021 by Alexandru-Sergiu Marton
+
+   This file is part of shell243.
+   
+   shell243 is free software: you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+   
+   shell243 is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+   
+   You should have received a copy of the GNU General Public License
+   along with shell243.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/epoll.h>
+
+#include "waiter.h"
+#include "job.h"
+#include "reaper.h"
+#include "eval.h"
+#include "spawner.h"
+#include "cmdhash.h"
+#include "jobout.h"
+#include "fds.h"
+
+#define DEFAULT_KILL_AFTER 5.0
+
+static int
+exit_status (int wstatus)
+{
+  return WIFSIGNALED (wstatus) ? 128 + WTERMSIG (wstatus)
+    : WEXITSTATUS (wstatus);
+}
+
+// wait
+
+static bool
+is_waited (const job *j)
+{
+  return j->state == JOB_RUNNING || j->state == JOB_STOPPED;
+}
+
+// One wait keeps a pidfd per job in an epoll set for as long as it
+// lasts, so a wakeup costs nothing per job that is still running. Jobs
+// that get no pidfd are checked by pid whenever SIGCHLD comes. Only the
+// jobs' own pids are reaped: wait may be the last stage of a pipe
+// sequence whose other stages are pipe_wait's.
+typedef struct watch
+{
+  job *j;
+  int fd; // the pidfd, or -1
+  bool done;
+} watch;
+
+typedef struct wait_set
+{
+  int epfd;
+  watch *watches;
+  int nwatches, cap;
+  int pending, nopidfd; // watches not done, and those without a pidfd
+  // The jobs that were queued when the wait started, in the order they
+  // will start, and how many of them have been watched since.
+  job **queued;
+  int nqueued, started;
+} wait_set;
+
+// Reaps the job of watches[i] if it has exited, or waits for it to
+// unless `flags' is WNOHANG.
+static void
+reap_watch (wait_set *w, int i, int flags)
+{
+  watch *e = &w->watches[i];
+  int wstatus;
+  pid_t pid;
+  while ((pid = waitpid (e->j->pid, &wstatus, flags)) == -1 && errno == EINTR)
+    ;
+  if (pid == 0)
+    return;
+  // -1 is ECHILD: someone else reaped it and updated the job.
+  if (pid > 0)
+    job_update (e->j, wstatus);
+
+  e->done = true;
+  w->pending--;
+  if (e->fd == -1)
+    w->nopidfd--;
+  else
+    {
+      epoll_ctl (w->epfd, EPOLL_CTL_DEL, e->fd, NULL);
+      close (e->fd);
+    }
+}
+
+static void
+watch_job (wait_set *w, job *j)
+{
+  if (!is_waited (j))
+    return;
+
+  if (w->nwatches == w->cap)
+    {
+      w->cap = w->cap ? w->cap * 2 : 16;
+      w->watches = (watch *) realloc (w->watches, sizeof (watch) * w->cap);
+    }
+  int i = w->nwatches++;
+  watch *e = &w->watches[i];
+  *e = (watch) { .j = j, .fd = w->epfd == -1 ? -1 : fd_pidfd (j->pid) };
+  w->pending++;
+
+  struct epoll_event ev = { .events = EPOLLIN, .data.u32 = i };
+  if (e->fd != -1 && epoll_ctl (w->epfd, EPOLL_CTL_ADD, e->fd, &ev) == -1)
+    {
+      close (e->fd);
+      e->fd = -1;
+    }
+  if (e->fd == -1)
+    {
+      // It may be gone already, and its SIGCHLD with it.
+      w->nopidfd++;
+      reap_watch (w, i, WNOHANG);
+    }
+}
+
+// Watches the queued jobs that have started since the last call.
+static void
+watch_started (wait_set *w)
+{
+  while (w->started < w->nqueued
+	 && w->queued[w->started]->state != JOB_QUEUED)
+    watch_job (w, w->queued[w->started++]);
+}
+
+// Blocks until a watched job exits, collecting job output meanwhile.
+static void
+wait_event (wait_set *w)
+{
+  if (w->nopidfd && reaper_fd () == -1)
+    {
+      // No pidfd and no SIGCHLD pipe: block on one of them by pid.
+      for (int i = 0; i < w->nwatches; i++)
+	if (!w->watches[i].done && w->watches[i].fd == -1)
+	  {
+	    reap_watch (w, i, 0);
+	    return;
+	  }
+    }
+
+  struct pollfd fds[3] = {
+    { .fd = w->epfd, .events = POLLIN },
+    { .fd = jobout_fd (), .events = POLLIN },
+    { .fd = w->nopidfd ? reaper_fd () : -1, .events = POLLIN }
+  };
+  if (poll (fds, 3, -1) == -1)
+    return;
+
+  if (fds[1].revents)
+    jobout_drain ();
+  if (fds[2].revents)
+    {
+      reaper_clear ();
+      for (int i = 0; i < w->nwatches; i++)
+	if (!w->watches[i].done && w->watches[i].fd == -1)
+	  reap_watch (w, i, WNOHANG);
+    }
+  if (fds[0].revents)
+    {
+      struct epoll_event events[64];
+      int n = epoll_wait (w->epfd, events, 64, 0);
+      for (int i = 0; i < n; i++)
+	reap_watch (w, events[i].data.u32, WNOHANG);
+    }
+}
+
+// Watches `targets', or every job if there are none or some of them
+// are still queued: then any job finishing may let them start.
+static void
+watch_targets (wait_set *w, job **targets, int ntargets)
+{
+  bool all = ntargets == 0;
+  for (int i = 0; i < ntargets; i++)
+    if (targets[i]->state == JOB_QUEUED)
+      all = true;
+
+  if (!all)
+    {
+      for (int i = 0; i < ntargets; i++)
+	watch_job (w, targets[i]);
+      return;
+    }
+
+  for (job *j = job_next (NULL); j; j = job_next (j))
+    if (j->state != JOB_QUEUED)
+      watch_job (w, j);
+  for (job *q = job_first_queued (); q; q = q->next_queued)
+    w->nqueued++;
+  w->queued = (job **) malloc (sizeof (job *) * (w->nqueued + 1));
+  int n = 0;
+  for (job *q = job_first_queued (); q; q = q->next_queued)
+    w->queued[n++] = q;
+}
+
+static void
+wait_set_free (wait_set *w)
+{
+  for (int i = 0; i < w->nwatches; i++)
+    if (!w->watches[i].done && w->watches[i].fd != -1)
+      close (w->watches[i].fd);
+  if (w->epfd != -1)
+    close (w->epfd);
+  free (w->watches);
+  free (w->queued);
+}
+
+static job *
+parse_jobspec (const char *arg)
+{
+  char *end;
+  long n = strtol (arg[0] == '%' ? arg + 1 : arg, &end, 10);
+  job *j = NULL;
+  if (*end == '\0' && end != arg && n > 0)
+    j = arg[0] == '%' ? job_get (n) : job_find (n);
+
+  if (!j)
+    fprintf (stderr, "wait: %s: no such job\n", arg);
+  return j;
+}
+
+// Jobs being waited for are either done, or waiting on something.
+static bool
+all_done (job **targets, int ntargets)
+{
+  if (ntargets == 0)
+    return job_active_count () == 0 && !job_first_queued ();
+
+  for (int i = 0; i < ntargets; i++)
+    if (targets[i]->state != JOB_DONE)
+      return false;
+  return true;
+}
+
+static job *
+first_done (job **targets, int ntargets)
+{
+  if (ntargets == 0)
+    {
+      for (job *j = job_next (NULL); j; j = job_next (j))
+	if (j->state == JOB_DONE)
+	  return j;
+      return NULL;
+    }
+
+  for (int i = 0; i < ntargets; i++)
+    if (targets[i]->state == JOB_DONE)
+      return targets[i];
+  return NULL;
+}
+
+int
+builtin_wait (int argc, char **argv)
+{
+  bool next = false;
+  int i = 1;
+  if (i < argc && strcmp (argv[i], "-n") == 0)
+    {
+      next = true;
+      i++;
+    }
+
+  int ntargets = argc - i, status = EXIT_SUCCESS;
+  job **targets = (job **) malloc (sizeof (job *) * (ntargets + 1));
+  for (int k = 0; k < ntargets; k++)
+    if (!(targets[k] = parse_jobspec (argv[i + k])))
+      {
+	free (targets);
+	return 127;
+      }
+
+  wait_set w = { .epfd = epoll_create1 (EPOLL_CLOEXEC) };
+  start_queued_jobs ();
+  watch_targets (&w, targets, ntargets);
+  watch_started (&w);
+
+  for (;;)
+    {
+      job *done = next ? first_done (targets, ntargets) : NULL;
+      if (done || (!next && all_done (targets, ntargets)))
+	break;
+      if (w.pending == 0 && w.started == w.nqueued)
+	{
+	  // Stopped or nothing left to wait for.
+	  if (next)
+	    status = 127;
+	  break;
+	}
+
+      wait_event (&w);
+      start_queued_jobs ();
+      watch_started (&w);
+    }
+  wait_set_free (&w);
+
+  // Jobs that were waited for don't get a "Done" line later.
+  if (next)
+    {
+      job *done = first_done (targets, ntargets);
+      if (done)
+	{
+	  status = exit_status (done->status);
+	  job_remove (done);
+	}
+    }
+  else if (ntargets > 0)
+    {
+      status = exit_status (targets[ntargets - 1]->status);
+      for (int k = 0; k < ntargets; k++)
+	{
+	  // The same job may be given twice.
+	  for (int m = k + 1; m < ntargets; m++)
+	    if (targets[m] == targets[k])
+	      targets[m] = NULL;
+	  if (targets[k])
+	    job_remove (targets[k]);
+	}
+    }
+  else
+    {
+      job *j = job_next (NULL);
+      while (j)
+	{
+	  job *after = job_next (j);
+	  if (j->state == JOB_DONE)
+	    job_remove (j);
+	  j = after;
+	}
+    }
+
+  free (targets);
+  return status;
+}
+
+// timeout
+
+static bool
+parse_duration (const char *s, double *seconds)
+{
+  char *end;
+  double value = strtod (s, &end);
+  if (end == s || value < 0)
+    return false;
+
+  if (strcmp (end, "m") == 0)
+    value *= 60;
+  else if (strcmp (end, "h") == 0)
+    value *= 60 * 60;
+  else if (strcmp (end, "d") == 0)
+    value *= 24 * 60 * 60;
+  else if (*end != '\0' && strcmp (end, "s") != 0)
+    return false;
+
+  *seconds = value;
+  return true;
+}
+
+static double
+now ()
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Waits up to `seconds' for `pid' to exit, and reaps it if it does.
+// 0 seconds is no limit, as with GNU timeout.
+static bool
+wait_exit (pid_t pid, int pidfd, double seconds, int *wstatus)
+{
+  double deadline = now () + seconds;
+
+  if (seconds == 0)
+    {
+      while (waitpid (pid, wstatus, 0) == -1)
+	if (errno != EINTR)
+	  return false;
+      return true;
+    }
+
+  for (;;)
+    {
+      double left = deadline - now ();
+      if (pidfd != -1)
+	{
+	  struct pollfd fd = { .fd = pidfd, .events = POLLIN };
+	  int ms = left <= 0 ? 0 : left * 1000 + 1;
+	  int n = poll (&fd, 1, ms);
+	  if (n == -1 && errno == EINTR)
+	    continue;
+	  if (n <= 0)
+	    return false;
+	  return waitpid (pid, wstatus, 0) == pid;
+	}
+
+      // Without a pidfd, fall back to checking every 10ms.
+      if (waitpid (pid, wstatus, WNOHANG) == pid)
+	return true;
+      if (left <= 0)
+	return false;
+      struct timespec tick = { 0, 10 * 1000 * 1000 };
+      nanosleep (&tick, NULL);
+    }
+}
+
+int
+builtin_timeout (int argc, char **argv)
+{
+  double duration, kill_after = DEFAULT_KILL_AFTER;
+  int i = 1;
+
+  if (i + 1 < argc && strcmp (argv[i], "-k") == 0)
+    {
+      if (!parse_duration (argv[i + 1], &kill_after))
+	{
+	  fprintf (stderr, "timeout: %s: invalid duration\n", argv[i + 1]);
+	  return 125;
+	}
+      i += 2;
+    }
+  if (i + 1 >= argc)
+    {
+      fprintf (stderr, "usage: timeout [-k DURATION] DURATION command "
+	       "[arg]...\n");
+      return 125;
+    }
+  if (!parse_duration (argv[i], &duration))
+    {
+      fprintf (stderr, "timeout: %s: invalid duration\n", argv[i]);
+      return 125;
+    }
+
+  char **command = argv + i + 1;
+  fflush (stdout);
+  pid_t pid = spawn_process (cmdhash_lookup (command[0]), command,
+			     STDIN_FILENO, STDOUT_FILENO, NULL, 0);
+  if (pid == -1)
+    {
+      fprintf (stderr, "timeout: %s: %s\n", command[0], strerror (errno));
+      return errno == ENOENT ? 127 : 126;
+    }
+
+  int pidfd = fd_pidfd (pid), wstatus, status;
+  if (wait_exit (pid, pidfd, duration, &wstatus))
+    status = exit_status (wstatus);
+  else
+    {
+      kill (pid, SIGTERM);
+      status = 124;
+      if (!wait_exit (pid, pidfd, kill_after, &wstatus))
+	{
+	  kill (pid, SIGKILL);
+	  while (waitpid (pid, &wstatus, 0) == -1 && errno == EINTR)
+	    ;
+	  status = 128 + SIGKILL;
+	}
+    }
+
+  if (pidfd != -1)
+    close (pidfd);
+  return status;
+}
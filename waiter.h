@@ -0,0 +1,44 @@
+/* Copyright (C) 2021 by Alexandru-Sergiu Marton
+
+   This file is part of shell243.
+   
+   shell243 is free software: you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+   
+   shell243 is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+   
+   You should have received a copy of the GNU General Public License
+   along with shell243.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef SH243_WAITER_H
+#define SH243_WAITER_H
+
+// Both builtins block on pidfds, so there is no polling loop and no
+// race with SIGCHLD, and both only ever reap the processes they wait
+// for.
+
+// wait [-n] [%jid | pid]...
+//
+// Waits for the given background jobs, or for all of them, and returns
+// the exit status of the last one given. With -n, returns as soon as
+// one of them is done, with its status.
+int
+builtin_wait (int argc, char **argv);
+
+// timeout [-k DURATION] DURATION command [arg]...
+//
+// Runs the command and sends it SIGTERM once DURATION is up, then
+// SIGKILL if it is still running -k DURATION (5s by default) later.
+// Durations are seconds, or take an s, m, h or d suffix; 0 is no limit,
+// as with GNU timeout. Returns 124 when the command timed out, 137 if
+// it had to be killed.
+int
+builtin_timeout (int argc, char **argv);
+
+#endif